@@ -0,0 +1,452 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "yaffs_guts.h"
+
+#include "checkpoint.h"
+
+/*----------------------------------------------------------------------------*/
+
+/* enum yaffs_block_state */
+#define CHECKPT_BLOCK_EMPTY		3
+#define CHECKPT_BLOCK_ALLOCATING	4
+#define CHECKPT_BLOCK_FULL		5
+
+/* sizes of the kernel structures, stored as their struct_type as well */
+#define CHECKPT_VALIDITY_SIZE	16	/* struct yaffs_checkpt_validity */
+#define CHECKPT_DEV_SIZE	36	/* struct yaffs_checkpt_dev */
+#define CHECKPT_BLOCKINFO_SIZE	8	/* struct yaffs_block_info */
+#define CHECKPT_OBJ_SIZE	32	/* struct yaffs_checkpt_obj */
+#define CHECKPT_TNODE_MAX	64	/* struct yaffs_tnode, 64-bit pointers */
+
+/*----------------------------------------------------------------------------*/
+
+static int
+checkpt_host_big_endian (void)
+{
+	const unsigned one = 1;
+
+	return *(const unsigned char *)&one == 0;
+}
+
+/* calc_shifts_ceiling() of yaffs_guts.c */
+static unsigned
+checkpt_shifts_ceiling (unsigned x)
+{
+	unsigned shifts = 0, extra_bits = 0;
+
+	while (x > 1) {
+		if (x & 1)
+			extra_bits++;
+		x >>= 1;
+		shifts++;
+	}
+
+	return extra_bits ? shifts + 1 : shifts;
+}
+
+static void
+checkpt_put (struct checkpt *cp, const void *buf, size_t len)
+{
+	size_t i;
+	const unsigned char *p = buf;
+
+	/* the running checksum of yaffs2_checkpt_wr() */
+	for (i = 0; i < len; i++) {
+		cp->sum += p[i];
+		cp->xor ^= p[i];
+	}
+
+	memcpy(cp->data + cp->len, buf, len);
+	cp->len += len;
+}
+
+static void
+checkpt_put32 (struct checkpt *cp, unsigned v)
+{
+	unsigned char b[4];
+
+	if (cp->big_endian) {
+		b[0] = v >> 24;
+		b[1] = v >> 16;
+		b[2] = v >> 8;
+		b[3] = v;
+	}
+	else {
+		b[0] = v;
+		b[1] = v >> 8;
+		b[2] = v >> 16;
+		b[3] = v >> 24;
+	}
+
+	checkpt_put(cp, b, sizeof(b));
+}
+
+static void
+checkpt_put64 (struct checkpt *cp, unsigned long long v)
+{
+	if (cp->big_endian) {
+		checkpt_put32(cp, v >> 32);
+		checkpt_put32(cp, v);
+	}
+	else {
+		checkpt_put32(cp, v);
+		checkpt_put32(cp, v >> 32);
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* the internal block (and chunk) numbers of the kernel start at block 1 */
+static inline unsigned
+checkpt_nand_chunk (const struct checkpt *cp, unsigned page)
+{
+	return page + cp->pages_per_block;
+}
+
+static unsigned
+checkpt_pages_in_use (const struct checkpt *cp, unsigned block)
+{
+	unsigned first = block * cp->pages_per_block;
+	unsigned pad = cp->padding ? cp->padding[block] : 0;
+
+	if (cp->used_pages <= first)
+		return 0;
+
+	return cp->used_pages - first < cp->pages_per_block ?
+	       cp->used_pages - first : cp->pages_per_block - pad;
+}
+
+static void
+checkpt_put_validity (struct checkpt *cp, int head)
+{
+	checkpt_put32(cp, CHECKPT_VALIDITY_SIZE);
+	checkpt_put32(cp, CHECKPT_MAGIC);
+	checkpt_put32(cp, CHECKPT_VERSION);
+	checkpt_put32(cp, head ? 1 : 0);
+}
+
+static void
+checkpt_put_dev (struct checkpt *cp)
+{
+	unsigned b, i, n, in_use, state, bits, total = 0;
+	unsigned ppb = cp->pages_per_block;
+	unsigned used = (cp->used_pages + ppb - 1) / ppb;
+	unsigned stride = (ppb + 7) / 8;
+	unsigned char byte;
+
+	for (b = 0; b < cp->blocks; b++)
+		total += checkpt_pages_in_use(cp, b);
+
+	/* struct yaffs_checkpt_dev */
+	checkpt_put32(cp, CHECKPT_DEV_SIZE);
+	checkpt_put32(cp, cp->blocks - used);		/* n_erased_blocks */
+	if (cp->used_pages % ppb) {
+		checkpt_put32(cp, used);		/* alloc_block */
+		checkpt_put32(cp, cp->used_pages % ppb);	/* alloc_page */
+	}
+	else {
+		checkpt_put32(cp, -1);
+		checkpt_put32(cp, 0);
+	}
+	checkpt_put32(cp, cp->blocks * ppb - total);	/* n_free_chunks */
+	checkpt_put32(cp, 0);				/* n_deleted_files */
+	checkpt_put32(cp, 0);				/* n_unlinked_files */
+	checkpt_put32(cp, 0);				/* n_bg_deletions */
+	checkpt_put32(cp, YAFFS_LOWEST_SEQUENCE_NUMBER + used);	/* seq_number */
+
+	/*
+	 * struct yaffs_block_info: soft_del_pages:10, pages_in_use:10,
+	 * block_state:4 and some flags, followed by the seq_number.
+	 */
+	for (b = 0; b < cp->blocks; b++) {
+		in_use = checkpt_pages_in_use(cp, b);
+
+		/* a padded block is full, as a partly written one at scan */
+		state = in_use == 0 ? CHECKPT_BLOCK_EMPTY :
+			in_use < ppb && b == cp->used_pages / ppb ?
+				       CHECKPT_BLOCK_ALLOCATING :
+				       CHECKPT_BLOCK_FULL;
+
+		/* bit-fields go from the msb on big endian targets */
+		bits = cp->big_endian ? (in_use << 12) | (state << 8) :
+					(in_use << 10) | (state << 20);
+
+		/* has_summary, after 3 more flags and chunk_error_strikes:3 */
+		if (cp->summary && in_use == ppb)
+			bits |= cp->big_endian ? 1 << 1 : 1 << 30;
+
+		checkpt_put32(cp, bits);
+		checkpt_put32(cp, in_use ?
+				  YAFFS_LOWEST_SEQUENCE_NUMBER + 1 + b : 0);
+	}
+
+	/* the chunks in use, a bit per page */
+	for (b = 0; b < cp->blocks; b++) {
+		in_use = checkpt_pages_in_use(cp, b);
+		for (i = 0; i < stride; i++) {
+			n = in_use > i * 8 ? in_use - i * 8 : 0;
+			byte = n >= 8 ? 0xff : (1 << n) - 1;
+			checkpt_put(cp, &byte, sizeof(byte));
+		}
+	}
+}
+
+static void
+checkpt_put_obj (struct checkpt *cp, const struct checkpt_obj *obj)
+{
+	int fake = obj->obj_id <= YAFFS_OBJECTID_DELETED;
+	unsigned char bits[4] = {0};
+
+	/* struct yaffs_checkpt_obj */
+	checkpt_put32(cp, CHECKPT_OBJ_SIZE);
+	checkpt_put32(cp, obj->obj_id);
+	checkpt_put32(cp, obj->parent_id);
+	checkpt_put32(cp, fake ? 0 : checkpt_nand_chunk(cp, obj->hdr_page));
+
+	/*
+	 * variant_type:3, deleted:1, soft_del:1, unlinked:1, fake:1,
+	 * rename_allowed:1, unlink_allowed:1, and then the u8 serial (0).
+	 * The fake directories can be neither renamed nor unlinked.
+	 */
+	if (cp->big_endian) {
+		bits[0] = (obj->type << 5) | (fake << 1) | !fake;
+		bits[1] = !fake << 7;
+	}
+	else {
+		bits[0] = obj->type | (fake << 6) | (!fake << 7);
+		bits[1] = !fake;
+	}
+	checkpt_put(cp, bits, sizeof(bits));
+
+	checkpt_put32(cp, obj->n_data_chunks);
+	checkpt_put64(cp, obj->size_or_equiv);
+}
+
+/* whether the kernel has the level 0 tnode 't' of a file */
+static int
+checkpt_tnode_used (const struct checkpt_obj *obj, unsigned t)
+{
+	unsigned pos, chunk;
+
+	/* a file always owns its top tnode, even an empty one */
+	if (t == 0 && obj->last_chunk < YAFFS_NTNODES_LEVEL0)
+		return 1;
+
+	/* and the others only hold chunks, not holes */
+	for (pos = 0; pos < YAFFS_NTNODES_LEVEL0; pos++) {
+		chunk = (t << YAFFS_TNODES_LEVEL0_BITS) + pos;
+		if (chunk > 0 && chunk <= obj->last_chunk &&
+		    obj->data_pages[chunk - 1] != CHECKPT_NO_PAGE)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* the level 0 tnodes of a file, as yaffs2_checkpt_tnode_worker() walks */
+static void
+checkpt_put_tnodes (struct checkpt *cp, const struct checkpt_obj *obj)
+{
+	unsigned t, pos, chunk, val, bit, word, shift;
+	unsigned map[CHECKPT_TNODE_MAX / sizeof(unsigned)];
+	unsigned mask = cp->tnode_width < 32 ?
+			(1U << cp->tnode_width) - 1 : ~0U;
+
+	for (t = 0; t <= obj->last_chunk >> YAFFS_TNODES_LEVEL0_BITS; t++) {
+		if (!checkpt_tnode_used(obj, t))
+			continue;
+
+		memset(map, 0, sizeof(map));
+
+		for (pos = 0; pos < YAFFS_NTNODES_LEVEL0; pos++) {
+			chunk = (t << YAFFS_TNODES_LEVEL0_BITS) + pos;
+			if (chunk == 0 || chunk > obj->last_chunk ||
+			    obj->data_pages[chunk - 1] == CHECKPT_NO_PAGE)
+				continue;
+
+			/* yaffs_load_tnode_0() */
+			val = checkpt_nand_chunk(cp, obj->data_pages[chunk - 1]);
+			bit = pos * cp->tnode_width;
+			word = bit / 32;
+			shift = bit & 31;
+
+			map[word] |= (val & mask) << shift;
+			if (cp->tnode_width > 32 - shift)
+				map[word + 1] |= (val & mask) >> (32 - shift);
+		}
+
+		checkpt_put32(cp, t << YAFFS_TNODES_LEVEL0_BITS);
+		for (word = 0; word < cp->tnode_size / sizeof(unsigned); word++)
+			checkpt_put32(cp, map[word]);
+	}
+
+	checkpt_put32(cp, ~0U);
+}
+
+/* hash buckets in order, the latest object first in each of them */
+static int
+checkpt_obj_cmp (const void *a, const void *b)
+{
+	const struct checkpt_obj *x = a, *y = b;
+	unsigned bx = x->obj_id % YAFFS_NOBJECT_BUCKETS;
+	unsigned by = y->obj_id % YAFFS_NOBJECT_BUCKETS;
+
+	if (bx != by)
+		return bx < by ? -1 : 1;
+
+	return x->obj_id < y->obj_id ? 1 : x->obj_id > y->obj_id ? -1 : 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void
+checkpt_init (struct checkpt *cp, unsigned pages_per_block,
+	      unsigned blocks, unsigned used_pages, int swap,
+	      unsigned ptr_bits)
+{
+	unsigned bits;
+
+	memset(cp, 0, sizeof(struct checkpt));
+
+	cp->pages_per_block = pages_per_block;
+	cp->blocks = blocks;
+	cp->used_pages = used_pages;
+	cp->big_endian = checkpt_host_big_endian() ^ !!swap;
+
+	/* wide tnodes, as yaffs_guts_initialise() sizes them */
+	bits = checkpt_shifts_ceiling(pages_per_block * (blocks + 1));
+	if (bits & 1)
+		bits++;
+	cp->tnode_width = bits < 16 ? 16 : bits;
+
+	cp->tnode_size = cp->tnode_width * YAFFS_NTNODES_LEVEL0 / 8;
+	if (cp->tnode_size < YAFFS_NTNODES_INTERNAL * ptr_bits / 8)
+		cp->tnode_size = YAFFS_NTNODES_INTERNAL * ptr_bits / 8;
+}
+
+void
+checkpt_release (struct checkpt *cp)
+{
+	free(cp->objs);
+	free(cp->data);
+
+	cp->objs = NULL;
+	cp->data = NULL;
+}
+
+int
+checkpt_add_obj (struct checkpt *cp, const struct checkpt_obj *obj)
+{
+	unsigned max;
+	struct checkpt_obj *objs;
+
+	if (cp->n_objs == cp->max_objs) {
+		max = cp->max_objs ? cp->max_objs * 2 : 256;
+		objs = realloc(cp->objs, max * sizeof(struct checkpt_obj));
+		if (objs == NULL)
+			return -1;
+
+		cp->objs = objs;
+		cp->max_objs = max;
+	}
+
+	cp->objs[cp->n_objs++] = *obj;
+
+	return 0;
+}
+
+int
+checkpt_build (struct checkpt *cp)
+{
+	unsigned i, t;
+	size_t size;
+	struct checkpt_obj *obj;
+	unsigned char end[CHECKPT_OBJ_SIZE - 4];
+
+	/* the fake directories, which the kernel always has */
+	struct checkpt_obj fake = {0};
+
+	fake.type = YAFFS_OBJECT_TYPE_DIRECTORY;
+	for (i = YAFFS_OBJECTID_ROOT; i <= YAFFS_OBJECTID_DELETED; i++) {
+		fake.obj_id = i;
+		fake.parent_id = i == YAFFS_OBJECTID_LOSTNFOUND ?
+				 YAFFS_OBJECTID_ROOT : 0;
+		if (checkpt_add_obj(cp, &fake))
+			return -1;
+	}
+
+	qsort(cp->objs, cp->n_objs, sizeof(struct checkpt_obj),
+	      checkpt_obj_cmp);
+
+	size = 2 * CHECKPT_VALIDITY_SIZE + CHECKPT_DEV_SIZE +
+	       (size_t)cp->blocks * (CHECKPT_BLOCKINFO_SIZE +
+				     (cp->pages_per_block + 7) / 8) +
+	       (cp->n_objs + 1) * CHECKPT_OBJ_SIZE + sizeof(unsigned);
+	for (i = 0; i < cp->n_objs; i++) {
+		obj = &cp->objs[i];
+		if (obj->type != YAFFS_OBJECT_TYPE_FILE)
+			continue;
+
+		for (t = 0; t <= obj->last_chunk >> YAFFS_TNODES_LEVEL0_BITS;
+		     t++) {
+			if (checkpt_tnode_used(obj, t))
+				size += sizeof(unsigned) + cp->tnode_size;
+		}
+		size += sizeof(unsigned);
+	}
+
+	free(cp->data);
+	cp->data = malloc(size);
+	if (cp->data == NULL)
+		return -1;
+
+	cp->len = 0;
+	cp->sum = 0;
+	cp->xor = 0;
+
+	/* yaffs2_wr_checkpt_data() */
+	checkpt_put_validity(cp, 1);
+	checkpt_put_dev(cp);
+
+	for (i = 0; i < cp->n_objs; i++) {
+		obj = &cp->objs[i];
+		checkpt_put_obj(cp, obj);
+		if (obj->type == YAFFS_OBJECT_TYPE_FILE)
+			checkpt_put_tnodes(cp, obj);
+	}
+
+	/* end of the object list: all 0xff but the struct_type */
+	memset(end, 0xff, sizeof(end));
+	checkpt_put32(cp, CHECKPT_OBJ_SIZE);
+	checkpt_put(cp, end, sizeof(end));
+
+	checkpt_put_validity(cp, 0);
+	checkpt_put32(cp, (cp->sum << 8) | cp->xor);
+
+	return 0;
+}
+
+unsigned
+checkpt_max_blocks (const struct checkpt *cp)
+{
+	return (cp->blocks - 1) / 16 + 2;
+}
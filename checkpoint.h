@@ -0,0 +1,86 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_CHECKPOINT_H__
+#define __YAFFS2UTILS_CHECKPOINT_H__
+
+#include <stddef.h>
+
+/*
+ * The checkpoint format of the YAFFS2 kernel code (yaffs_yaffs2.c and
+ * yaffs_checkptrw.c), which a mount restores instead of scanning.
+ */
+#define CHECKPT_MAGIC		0x5941ff53	/* YAFFS_MAGIC */
+#define CHECKPT_VERSION		7		/* YAFFS_CHECKPOINT_VERSION */
+#define CHECKPT_SEQUENCE	0x21		/* YAFFS_SEQUENCE_CHECKPOINT_DATA */
+
+#define CHECKPT_NO_PAGE		(~0U)		/* a hole in a sparse file */
+
+/* an object of the image */
+typedef struct checkpt_obj {
+	unsigned obj_id;
+	unsigned parent_id;
+	unsigned type;			/* YAFFS_OBJECT_TYPE_* of the header */
+	unsigned hdr_page;		/* page of the object header */
+	const unsigned *data_pages;	/* page of every data chunk */
+	unsigned last_chunk;		/* entries of data_pages */
+	unsigned n_data_chunks;		/* holes excluded */
+	unsigned long long size_or_equiv;	/* file size, or equiv id */
+} checkpt_obj_t;
+
+typedef struct checkpt {
+	unsigned pages_per_block;
+	unsigned blocks;		/* erase blocks of the partition */
+	unsigned used_pages;		/* pages in use from the first block */
+	int big_endian;			/* byte order of the target */
+	int summary;			/* full blocks end with a summary */
+	const unsigned *padding;	/* erased pages ending each block */
+
+	unsigned tnode_width;		/* bits per level 0 tnode entry */
+	unsigned tnode_size;		/* bytes, at least a struct yaffs_tnode */
+
+	unsigned n_objs;
+	unsigned max_objs;
+	struct checkpt_obj *objs;
+
+	unsigned char *data;		/* the serialized checkpoint */
+	size_t len;
+	unsigned sum;
+	unsigned char xor;
+} checkpt_t;
+
+/*
+ * 'swap' is set when the target has the other byte order than the host
+ * (mkyaffs2 -e). 'ptr_bits' is the pointer size of the target kernel, 32
+ * or 64: a tnode is never smaller than struct yaffs_tnode, eight pointers,
+ * and a kernel that reads tnodes of another size drops the checkpoint.
+ */
+void checkpt_init (struct checkpt *cp, unsigned pages_per_block,
+		   unsigned blocks, unsigned used_pages, int swap,
+		   unsigned ptr_bits);
+void checkpt_release (struct checkpt *cp);
+
+int checkpt_add_obj (struct checkpt *cp, const struct checkpt_obj *obj);
+
+/* serialize the device state and the objects into cp->data */
+int checkpt_build (struct checkpt *cp);
+
+/* the most blocks the kernel looks through for the checkpoint */
+unsigned checkpt_max_blocks (const struct checkpt *cp);
+
+#endif
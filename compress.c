@@ -0,0 +1,263 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef _HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "safe_rw.h"
+#include "compress.h"
+
+/*----------------------------------------------------------------------------*/
+
+#ifdef _HAVE_ZLIB
+static int
+compress_gzip (struct compress_frame *f, const unsigned char *in, size_t len,
+	       int level)
+{
+	int retval;
+	z_stream z;
+
+	memset(&z, 0, sizeof(z_stream));
+
+	/* 16 + 15: a gzip member with the largest window */
+	if (deflateInit2(&z, level, Z_DEFLATED, 16 + 15, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK)
+		return -1;
+
+	z.next_in = (unsigned char *)in;
+	z.avail_in = len;
+	z.next_out = f->out;
+	z.avail_out = f->size;
+
+	retval = deflate(&z, Z_FINISH);
+	f->len = f->size - z.avail_out;
+	deflateEnd(&z);
+
+	return retval == Z_STREAM_END ? 0 : -1;
+}
+#endif
+
+#ifdef _HAVE_ZSTD
+static int
+compress_zstd (struct compress_frame *f, const unsigned char *in, size_t len,
+	       int level)
+{
+	size_t n = ZSTD_compress(f->out, f->size, in, len, level);
+
+	if (ZSTD_isError(n))
+		return -1;
+
+	f->len = n;
+
+	return 0;
+}
+#endif
+
+static size_t
+compress_bound (unsigned mode, size_t len)
+{
+	switch (mode) {
+#ifdef _HAVE_ZLIB
+	case COMPRESS_GZIP:
+		/* the gzip header and trailer take 12 bytes more than zlib */
+		return compressBound(len) + 32;
+#endif
+#ifdef _HAVE_ZSTD
+	case COMPRESS_ZSTD:
+		return ZSTD_compressBound(len);
+#endif
+	default:
+		return 0;
+	}
+}
+
+static void
+compress_frame_job (void *arg, unsigned job)
+{
+	struct compress_stream *cs = arg;
+	struct compress_frame *f = &cs->frame[job];
+	size_t offset = (size_t)job * COMPRESS_FRAME_SIZE;
+	size_t len = cs->in_len - offset;
+
+	if (len > COMPRESS_FRAME_SIZE)
+		len = COMPRESS_FRAME_SIZE;
+
+	f->error = -1;
+	f->len = 0;
+
+	switch (cs->mode) {
+#ifdef _HAVE_ZLIB
+	case COMPRESS_GZIP:
+		f->error = compress_gzip(f, cs->in + offset, len, cs->level);
+		break;
+#endif
+#ifdef _HAVE_ZSTD
+	case COMPRESS_ZSTD:
+		f->error = compress_zstd(f, cs->in + offset, len, cs->level);
+		break;
+#endif
+	default:
+		break;
+	}
+}
+
+/* compress the frames of the input in parallel, then write them in order */
+static int
+compress_flush (struct compress_stream *cs)
+{
+	unsigned i, jobs;
+	struct compress_frame *f;
+
+	if (cs->in_len == 0)
+		return 0;
+
+	jobs = (cs->in_len + COMPRESS_FRAME_SIZE - 1) / COMPRESS_FRAME_SIZE;
+	thread_pool_run(cs->pool, jobs, compress_frame_job, cs);
+
+	for (i = 0; i < jobs; i++) {
+		f = &cs->frame[i];
+		if (f->error) {
+			errno = EIO;
+			return -1;
+		}
+
+		if (safe_write(cs->fd, f->out, f->len) != f->len)
+			return -1;
+
+		cs->out_total += f->len;
+	}
+
+	cs->in_len = 0;
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
+int
+compress_mode (const char *name)
+{
+#ifdef _HAVE_ZLIB
+	if (!strcmp(name, "gzip"))
+		return COMPRESS_GZIP;
+#endif
+#ifdef _HAVE_ZSTD
+	if (!strcmp(name, "zstd"))
+		return COMPRESS_ZSTD;
+#endif
+	return -1;
+}
+
+int
+compress_default_level (unsigned mode)
+{
+	return mode == COMPRESS_ZSTD ? 3 : 6;
+}
+
+int
+compress_start (struct compress_stream *cs, int fd, unsigned mode,
+		int level, unsigned frames, struct thread_pool *pool)
+{
+	unsigned i;
+
+	memset(cs, 0, sizeof(struct compress_stream));
+	cs->fd = fd;
+	cs->mode = mode;
+	cs->level = level;
+	cs->pool = pool;
+	cs->frames = frames ? frames : 1;
+
+	if (compress_bound(mode, COMPRESS_FRAME_SIZE) == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	cs->in = malloc((size_t)cs->frames * COMPRESS_FRAME_SIZE);
+	cs->frame = calloc(cs->frames, sizeof(struct compress_frame));
+	if (cs->in == NULL || cs->frame == NULL)
+		goto error;
+
+	for (i = 0; i < cs->frames; i++) {
+		cs->frame[i].size = compress_bound(mode, COMPRESS_FRAME_SIZE);
+		cs->frame[i].out = malloc(cs->frame[i].size);
+		if (cs->frame[i].out == NULL)
+			goto error;
+	}
+
+	return 0;
+
+error:
+	compress_release(cs);
+	return -1;
+}
+
+int
+compress_write (struct compress_stream *cs, const void *buf, size_t size)
+{
+	size_t n, room;
+	const unsigned char *p = buf;
+
+	while (size > 0) {
+		room = (size_t)cs->frames * COMPRESS_FRAME_SIZE - cs->in_len;
+		n = size < room ? size : room;
+
+		memcpy(cs->in + cs->in_len, p, n);
+		cs->in_len += n;
+		cs->in_total += n;
+		p += n;
+		size -= n;
+
+		if (cs->in_len == (size_t)cs->frames * COMPRESS_FRAME_SIZE &&
+		    compress_flush(cs))
+			return -1;
+	}
+
+	return 0;
+}
+
+int
+compress_finish (struct compress_stream *cs)
+{
+	return compress_flush(cs);
+}
+
+void
+compress_release (struct compress_stream *cs)
+{
+	unsigned i;
+
+	if (cs->frame) {
+		for (i = 0; i < cs->frames; i++)
+			free(cs->frame[i].out);
+	}
+
+	free(cs->frame);
+	free(cs->in);
+
+	cs->frame = NULL;
+	cs->in = NULL;
+}
@@ -0,0 +1,72 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_COMPRESS_H__
+#define __YAFFS2UTILS_COMPRESS_H__
+
+#include <stddef.h>
+
+#include "thread_pool.h"
+
+#define COMPRESS_NONE		0
+#define COMPRESS_GZIP		1
+#define COMPRESS_ZSTD		2
+
+/* input bytes of every frame, compressed on its own */
+#define COMPRESS_FRAME_SIZE	(1 << 20)
+
+typedef struct compress_frame {
+	unsigned char *out;
+	size_t size;			/* of the output buffer */
+	size_t len;			/* compressed bytes */
+	int error;
+} compress_frame_t;
+
+/*
+ * A compressed output stream: the input is cut into frames which are
+ * compressed in parallel on the pool, and written in order as independent
+ * gzip members or zstd frames, so the output is one valid stream.
+ */
+typedef struct compress_stream {
+	int fd;
+	unsigned mode;
+	int level;
+	struct thread_pool *pool;
+
+	unsigned frames;		/* compressed at once */
+	struct compress_frame *frame;
+	unsigned char *in;
+	size_t in_len;
+
+	unsigned long long in_total;
+	unsigned long long out_total;
+} compress_stream_t;
+
+/* the mode of "gzip" or "zstd", -1 if unknown or not built in */
+int compress_mode (const char *name);
+int compress_default_level (unsigned mode);
+
+int compress_start (struct compress_stream *cs, int fd, unsigned mode,
+		    int level, unsigned frames, struct thread_pool *pool);
+int compress_write (struct compress_stream *cs, const void *buf, size_t size);
+
+/* compress and write out the rest of the input */
+int compress_finish (struct compress_stream *cs);
+void compress_release (struct compress_stream *cs);
+
+#endif
@@ -35,4 +35,8 @@
  #define _HAVE_BROKEN_MTD_H	1
 #endif
 
+#if defined(__linux__) || defined(__FreeBSD__)
+ #define _HAVE_SEEK_HOLE		1
+#endif
+
 #endif
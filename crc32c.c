@@ -0,0 +1,238 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "configs.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define _HAVE_X86_SIMD		1
+#endif
+#ifdef __ARM_FEATURE_CRC32
+#include <arm_acle.h>
+#endif
+
+#include "crc32c.h"
+
+#define CRC32C_POLY		0x82f63b78	/* reflected 0x1edc6f41 */
+
+/*----------------------------------------------------------------------------*/
+
+typedef struct crc32c_kernel {
+	const char *name;
+	int (*supported) (void);
+	uint32_t (*crc) (uint32_t, const unsigned char *, size_t);
+} crc32c_kernel_t;
+
+static uint32_t crc32c_init (uint32_t crc, const unsigned char *buf,
+			     size_t size);
+
+static uint32_t
+(*crc32c_fn) (uint32_t, const unsigned char *, size_t) = crc32c_init;
+
+static const char *crc32c_kernel_name = NULL;
+
+static uint32_t crc32c_table[8][256];
+
+static void
+crc32c_make_table (void)
+{
+	unsigned i, j;
+	uint32_t crc;
+
+	if (crc32c_table[0][1])
+		return;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		crc32c_table[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; i++) {
+		crc = crc32c_table[0][i];
+		for (j = 1; j < 8; j++) {
+			crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+			crc32c_table[j][i] = crc;
+		}
+	}
+}
+
+static int
+crc32c_has_table (void)
+{
+	crc32c_make_table();
+	return 1;
+}
+
+/* slicing-by-8, on the state inverted already */
+static uint32_t
+crc32c_slice8 (uint32_t crc, const unsigned char *buf, size_t size)
+{
+	uint32_t lo, hi;
+
+	for (; size && ((uintptr_t)buf & 7); size--)
+		crc = crc32c_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+	for (; size >= 8; size -= 8, buf += 8) {
+		memcpy(&lo, buf, sizeof(lo));
+		memcpy(&hi, buf + 4, sizeof(hi));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		lo = __builtin_bswap32(lo);
+		hi = __builtin_bswap32(hi);
+#endif
+		lo ^= crc;
+		crc = crc32c_table[7][lo & 0xff] ^
+		      crc32c_table[6][(lo >> 8) & 0xff] ^
+		      crc32c_table[5][(lo >> 16) & 0xff] ^
+		      crc32c_table[4][lo >> 24] ^
+		      crc32c_table[3][hi & 0xff] ^
+		      crc32c_table[2][(hi >> 8) & 0xff] ^
+		      crc32c_table[1][(hi >> 16) & 0xff] ^
+		      crc32c_table[0][hi >> 24];
+	}
+
+	for (; size; size--)
+		crc = crc32c_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#ifdef _HAVE_X86_SIMD
+static int
+crc32c_has_sse42 (void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2");
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_sse42 (uint32_t crc, const unsigned char *buf, size_t size)
+{
+#ifdef __x86_64__
+	uint64_t w, c = crc;
+
+	for (; size && ((uintptr_t)buf & 7); size--)
+		c = _mm_crc32_u8(c, *buf++);
+
+	for (; size >= 8; size -= 8, buf += 8) {
+		memcpy(&w, buf, sizeof(w));
+		c = _mm_crc32_u64(c, w);
+	}
+	crc = c;
+#else
+	uint32_t w;
+
+	for (; size >= 4; size -= 4, buf += 4) {
+		memcpy(&w, buf, sizeof(w));
+		crc = _mm_crc32_u32(crc, w);
+	}
+#endif
+
+	for (; size; size--)
+		crc = _mm_crc32_u8(crc, *buf++);
+
+	return crc;
+}
+#endif
+
+#ifdef __ARM_FEATURE_CRC32
+static int
+crc32c_always (void)
+{
+	return 1;
+}
+
+static uint32_t
+crc32c_armv8 (uint32_t crc, const unsigned char *buf, size_t size)
+{
+	uint64_t w;
+
+	for (; size >= 8; size -= 8, buf += 8) {
+		memcpy(&w, buf, sizeof(w));
+		crc = __crc32cd(crc, w);
+	}
+
+	for (; size; size--)
+		crc = __crc32cb(crc, *buf++);
+
+	return crc;
+}
+#endif
+
+/* the preferred kernel comes first */
+static const struct crc32c_kernel crc32c_kernels[] = {
+#ifdef _HAVE_X86_SIMD
+	{"sse4.2",	crc32c_has_sse42,	crc32c_sse42},
+#endif
+#ifdef __ARM_FEATURE_CRC32
+	{"armv8",	crc32c_always,		crc32c_armv8},
+#endif
+	{"slice8",	crc32c_has_table,	crc32c_slice8},
+	{NULL,		NULL,			NULL},
+};
+
+int
+crc32c_select (const char *name)
+{
+	const struct crc32c_kernel *k;
+
+	for (k = crc32c_kernels; k->name != NULL; k++) {
+		if (name != NULL && strcmp(name, k->name))
+			continue;
+
+		if (k->supported()) {
+			crc32c_kernel_name = k->name;
+			crc32c_fn = k->crc;
+			return 0;
+		}
+
+		if (name != NULL)
+			break;
+	}
+
+	return -1;
+}
+
+const char *
+crc32c_name (void)
+{
+	if (crc32c_kernel_name == NULL)
+		crc32c_select(NULL);
+
+	return crc32c_kernel_name;
+}
+
+static uint32_t
+crc32c_init (uint32_t crc, const unsigned char *buf, size_t size)
+{
+	crc32c_select(NULL);
+	return crc32c_fn(crc, buf, size);
+}
+
+/*----------------------------------------------------------------------------*/
+
+uint32_t
+crc32c (uint32_t crc, const void *buf, size_t size)
+{
+	return ~crc32c_fn(~crc, buf, size);
+}
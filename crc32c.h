@@ -0,0 +1,36 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_CRC32C_H__
+#define __YAFFS2UTILS_CRC32C_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC-32C (Castagnoli), as the crc32 instruction of SSE4.2 and ARMv8
+ * computes it. Starting from 0, runs can be chained: the CRC of 'a' then
+ * 'b' is that of the two one after another.
+ */
+uint32_t crc32c (uint32_t crc, const void *buf, size_t size);
+
+/* the kernel, the fastest supported by the running CPU by default */
+int crc32c_select (const char *name);
+const char *crc32c_name (void);
+
+#endif
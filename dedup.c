@@ -0,0 +1,228 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "safe_rw.h"
+#include "thread_pool.h"
+
+#include "dedup.h"
+
+/*----------------------------------------------------------------------------*/
+
+#define DEDUP_BUFSIZE		(64 * 1024)
+#define DEDUP_PRIME		0x9e3779b97f4a7c15ULL
+
+/*----------------------------------------------------------------------------*/
+
+/* a word at a time multiply-xorshift hash; matches are compared anyway */
+static unsigned long long
+dedup_hash_buf (unsigned long long h, const unsigned char *buf, size_t len)
+{
+	size_t i;
+	unsigned long long w;
+
+	for (i = 0; i + sizeof(w) <= len; i += sizeof(w)) {
+		memcpy(&w, buf + i, sizeof(w));
+		h = (h ^ w) * DEDUP_PRIME;
+		h ^= h >> 32;
+	}
+
+	for (; i < len; i++)
+		h = (h ^ buf[i]) * DEDUP_PRIME;
+
+	return h;
+}
+
+static void
+dedup_hash_job (void *arg, unsigned job)
+{
+	int fd;
+	ssize_t r;
+	unsigned char *buf;
+	unsigned long long h = 0, size = 0;
+	struct dedup_file *file = ((struct dedup_file **)arg)[job];
+
+	file->error = 1;
+
+	buf = malloc(DEDUP_BUFSIZE);
+	if (buf == NULL)
+		return;
+
+	fd = open(file->path, O_RDONLY);
+	if (fd < 0) {
+		free(buf);
+		return;
+	}
+
+	while ((r = safe_read(fd, buf, DEDUP_BUFSIZE)) > 0) {
+		h = dedup_hash_buf(h, buf, r);
+		size += r;
+	}
+
+	/* changed under our feet? */
+	if (r == 0 && size == file->size) {
+		file->hash = h;
+		file->error = 0;
+	}
+
+	close(fd);
+	free(buf);
+}
+
+static int
+dedup_same_content (const struct dedup_file *a, const struct dedup_file *b)
+{
+	int fa, fb, same = 0;
+	ssize_t ra, rb;
+	unsigned char *buf;
+
+	buf = malloc(DEDUP_BUFSIZE * 2);
+	if (buf == NULL)
+		return 0;
+
+	fa = open(a->path, O_RDONLY);
+	fb = open(b->path, O_RDONLY);
+	if (fa < 0 || fb < 0)
+		goto out;
+
+	do {
+		ra = safe_read(fa, buf, DEDUP_BUFSIZE);
+		rb = safe_read(fb, buf + DEDUP_BUFSIZE, DEDUP_BUFSIZE);
+		if (ra < 0 || ra != rb ||
+		    memcmp(buf, buf + DEDUP_BUFSIZE, ra))
+			goto out;
+	} while (ra > 0);
+
+	same = 1;
+out:
+	if (fa >= 0)
+		close(fa);
+	if (fb >= 0)
+		close(fb);
+	free(buf);
+
+	return same;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* the same size, mode and owner; then the earlier file first */
+static int
+dedup_cmp_attr (const void *x, const void *y)
+{
+	const struct dedup_file *a = *(struct dedup_file **)x;
+	const struct dedup_file *b = *(struct dedup_file **)y;
+
+	if (a->size != b->size)
+		return a->size < b->size ? -1 : 1;
+	if (a->mode != b->mode)
+		return a->mode < b->mode ? -1 : 1;
+	if (a->uid != b->uid)
+		return a->uid < b->uid ? -1 : 1;
+	if (a->gid != b->gid)
+		return a->gid < b->gid ? -1 : 1;
+
+	return a < b ? -1 : a > b ? 1 : 0;
+}
+
+static int
+dedup_same_attr (const struct dedup_file *a, const struct dedup_file *b)
+{
+	return a->size == b->size && a->mode == b->mode &&
+	       a->uid == b->uid && a->gid == b->gid;
+}
+
+static int
+dedup_cmp_hash (const void *x, const void *y)
+{
+	const struct dedup_file *a = *(struct dedup_file **)x;
+	const struct dedup_file *b = *(struct dedup_file **)y;
+
+	if (!dedup_same_attr(a, b))
+		return dedup_cmp_attr(x, y);
+	if (a->hash != b->hash)
+		return a->hash < b->hash ? -1 : 1;
+
+	return a < b ? -1 : a > b ? 1 : 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
+int
+dedup_files (struct dedup_file *files, unsigned n, struct thread_pool *pool)
+{
+	unsigned i, j, k, r, cands = 0;
+	int dups = 0;
+	struct dedup_file **sorted, *f, *rep;
+
+	for (i = 0; i < n; i++)
+		files[i].equiv = -1;
+
+	sorted = malloc(sizeof(struct dedup_file *) * (n ? n : 1));
+	if (sorted == NULL)
+		return -1;
+
+	for (i = 0; i < n; i++)
+		sorted[i] = &files[i];
+	qsort(sorted, n, sizeof(struct dedup_file *), dedup_cmp_attr);
+
+	/* only the files sharing the size (and so on) are worth hashing */
+	for (i = 0; i < n; i++) {
+		if ((i > 0 && dedup_same_attr(sorted[i], sorted[i - 1])) ||
+		    (i + 1 < n && dedup_same_attr(sorted[i], sorted[i + 1])))
+			sorted[cands++] = sorted[i];
+	}
+
+	thread_pool_run(pool, cands, dedup_hash_job, sorted);
+
+	qsort(sorted, cands, sizeof(struct dedup_file *), dedup_cmp_hash);
+
+	for (i = 0; i < cands; i = j) {
+		for (j = i + 1; j < cands &&
+		     dedup_same_attr(sorted[i], sorted[j]) &&
+		     sorted[i]->hash == sorted[j]->hash; j++)
+			;
+
+		/* a collision of the hash makes another group */
+		for (k = i + 1; k < j; k++) {
+			f = sorted[k];
+			if (f->error)
+				continue;
+
+			for (r = i; r < k; r++) {
+				rep = sorted[r];
+				if (rep->error || rep->equiv >= 0)
+					continue;
+
+				if (dedup_same_content(rep, f)) {
+					f->equiv = rep - files;
+					dups++;
+					break;
+				}
+			}
+		}
+	}
+
+	free(sorted);
+
+	return dups;
+}
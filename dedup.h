@@ -0,0 +1,47 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_DEDUP_H__
+#define __YAFFS2UTILS_DEDUP_H__
+
+struct thread_pool;
+
+/* a regular file, which may have the same content as an earlier one */
+typedef struct dedup_file {
+	const char *path;
+	unsigned long long size;
+	unsigned mode;
+	unsigned uid;
+	unsigned gid;
+
+	unsigned long long hash;	/* of the content */
+	int error;			/* unreadable, never merged */
+	int equiv;			/* earlier file of the same content */
+	void *priv;
+} dedup_file_t;
+
+/*
+ * Find the files of the same size, mode, owner and content. The content
+ * is hashed on the pool, and every match is compared byte by byte. Each
+ * duplicate gets the index of the first such file in 'equiv', others -1.
+ * Returns the number of duplicates, or -1 when out of memory.
+ */
+int dedup_files (struct dedup_file *files, unsigned n,
+		 struct thread_pool *pool);
+
+#endif
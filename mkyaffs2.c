@@ -28,6 +28,7 @@
 #include <string.h>
 #include <libgen.h>
 #include <limits.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/param.h>
@@ -44,12 +45,29 @@
 #include "progress_bar.h"
 #include "endian_convert.h"
 #include "nand_ecclayout.h"
+#include "nand_ecc.h"
+#include "thread_pool.h"
+#include "checkpoint.h"
+#include "summary.h"
+#include "dedup.h"
+#include "sparse_image.h"
+#include "compress.h"
+#include "scrambler.h"
+#include "page_map.h"
+#include "mtd_fanout.h"
 
 #include "version.h"
 
+/* lseek() whences of the glibc, hidden without _GNU_SOURCE */
+#if defined(_HAVE_SEEK_HOLE) && !defined(SEEK_DATA)
+#define SEEK_DATA		3
+#define SEEK_HOLE		4
+#endif
+
 /*----------------------------------------------------------------------------*/
 
 #define MKYAFFS2_OBJTABLE_SIZE	4096
+#define MKYAFFS2_BATCH_PAGES	256
 
 #define MKYAFFS2_FLAGS_NONROOT	(1 << 0)
 #define MKYAFFS2_FLAGS_SHOWBAR	(1 << 1)
@@ -58,6 +76,16 @@
 #define MKYAFFS2_FLAGS_YAFFSECC	(1 << 18)
 #define MKYAFFS2_FLAGS_ALLROOT	(1 << 19)
 #define MKYAFFS2_FLAGS_VERBOSE	(1 << 20)
+#define MKYAFFS2_FLAGS_CHECKPT	(1 << 21)
+#define MKYAFFS2_FLAGS_SUMMARY	(1 << 22)
+#define MKYAFFS2_FLAGS_INBAND	(1 << 23)
+#define MKYAFFS2_FLAGS_SKIPZERO	(1 << 24)
+#define MKYAFFS2_FLAGS_DEDUP	(1 << 25)
+#define MKYAFFS2_FLAGS_ALIGNED	(1 << 26)
+#define MKYAFFS2_FLAGS_SPARSE	(1 << 27)
+#define MKYAFFS2_FLAGS_SYNDROME	(1 << 28)
+#define MKYAFFS2_FLAGS_SCRAMBLE	(1 << 29)
+#define MKYAFFS2_FLAGS_MTD	(1 << 30)
 
 #define MKYAFFS2_ISSHOWBAR	(mkyaffs2_flags & MKYAFFS2_FLAGS_SHOWBAR)
 #define MKYAFFS2_ISYAFFS1	(mkyaffs2_flags & MKYAFFS2_FLAGS_YAFFS1)
@@ -65,6 +93,21 @@
 #define MKYAFFS2_ISYAFFSECC	(mkyaffs2_flags & MKYAFFS2_FLAGS_YAFFSECC)
 #define MKYAFFS2_ISALLROOT	(mkyaffs2_flags & MKYAFFS2_FLAGS_ALLROOT)
 #define MKYAFFS2_ISVERBOSE	(mkyaffs2_flags & MKYAFFS2_FLAGS_VERBOSE)
+#define MKYAFFS2_ISCHECKPT	(mkyaffs2_flags & MKYAFFS2_FLAGS_CHECKPT)
+#define MKYAFFS2_ISSUMMARY	(mkyaffs2_flags & MKYAFFS2_FLAGS_SUMMARY)
+#define MKYAFFS2_ISINBAND	(mkyaffs2_flags & MKYAFFS2_FLAGS_INBAND)
+#define MKYAFFS2_ISSKIPZERO	(mkyaffs2_flags & MKYAFFS2_FLAGS_SKIPZERO)
+#define MKYAFFS2_ISDEDUP	(mkyaffs2_flags & MKYAFFS2_FLAGS_DEDUP)
+#define MKYAFFS2_ISALIGNED	(mkyaffs2_flags & MKYAFFS2_FLAGS_ALIGNED)
+#define MKYAFFS2_ISSPARSE	(mkyaffs2_flags & MKYAFFS2_FLAGS_SPARSE)
+#define MKYAFFS2_ISSYNDROME	(mkyaffs2_flags & MKYAFFS2_FLAGS_SYNDROME)
+#define MKYAFFS2_ISSCRAMBLE	(mkyaffs2_flags & MKYAFFS2_FLAGS_SCRAMBLE)
+#define MKYAFFS2_ISMTD		(mkyaffs2_flags & MKYAFFS2_FLAGS_MTD)
+
+/* the order of the objects in a directory for the aligned layout */
+#define MKYAFFS2_LAYOUT_SMALL	0	/* packed together */
+#define MKYAFFS2_LAYOUT_LARGE	1	/* each from a block boundary */
+#define MKYAFFS2_LAYOUT_DIR	2
 
 #define MKYAFFS2_PRINTF(s, args...) \
 		do { \
@@ -135,6 +178,18 @@ typedef struct mkyaffs2_obj {
 
 	char name[NAME_MAX + 1];
 
+	struct mkyaffs2_obj *dedup_obj;	/* earlier file of the same content */
+
+	unsigned layout;		/* MKYAFFS2_LAYOUT_* */
+	unsigned pages;			/* header and data, for the layout */
+
+	/* where it lies in the image, for the checkpoint */
+	unsigned hdr_page;
+	unsigned *data_pages;		/* page of every data chunk */
+	unsigned last_chunk;		/* entries of data_pages */
+	unsigned data_chunks;		/* holes excluded */
+	unsigned long long size_or_equiv;	/* file size, or equiv id */
+
 	struct list_head children;	/* for a directory */
 	struct list_head siblings;	/* neighbors in the same directory */
 	struct list_head hashlist;	/* hash table */
@@ -149,21 +204,91 @@ typedef struct mkyaffs2_fstree {
 
 static unsigned mkyaffs2_flags = 0;
 
-static unsigned mkyaffs2_chunksize = 0;
-static unsigned mkyaffs2_sparesize = 0;
+static unsigned mkyaffs2_pagesize = 0;
+static unsigned mkyaffs2_chunksize = 0;		/* data bytes of a chunk */
+static unsigned mkyaffs2_sparesize = 0;		/* or the inband tags */
 
 static unsigned mkyaffs2_image_obj_id = YAFFS_NOBJECT_BUCKETS;
 static unsigned mkyaffs2_image_objs = 0;
 static unsigned mkyaffs2_image_pages = 0;
+static unsigned mkyaffs2_image_blocks = 0;
+static unsigned mkyaffs2_queued_pages = 0;	/* padding included */
+static unsigned mkyaffs2_checkpt_blocks = 0;
+static unsigned mkyaffs2_checkpt_ptr = 32;	/* pointer bits of the kernel */
+static unsigned mkyaffs2_hole_chunks = 0;	/* left out of the image */
+static unsigned mkyaffs2_dedup_objs = 0;
+static unsigned long long mkyaffs2_dedup_bytes = 0;
+
+static struct dedup_file *mkyaffs2_dedup_list = NULL;
+static unsigned mkyaffs2_dedup_n = 0;
+
+static unsigned long long mkyaffs2_align_size = 0;
+static unsigned mkyaffs2_pad_pages = 0;		/* erased, for the layout */
+static unsigned *mkyaffs2_padding = NULL;	/* of every block */
+static unsigned mkyaffs2_padding_blocks = 0;
+
+static unsigned mkyaffs2_summary_chunks = 0;	/* data chunks per block */
+static struct summary_tags *mkyaffs2_summary = NULL;
+
+static unsigned mkyaffs2_pages_per_block = 0;
+static unsigned long long mkyaffs2_partition_size = 0;
 
 static int mkyaffs2_image_fd = -1;
+static int mkyaffs2_spare_fd = -1;		/* split spare output */
+static const char *mkyaffs2_sparefile = NULL;
+static struct sparse_image mkyaffs2_sparse = {0};
+static const char *mkyaffs2_mapfile = NULL;
+static struct page_map mkyaffs2_pagemap = {0};
+static struct mtd_target *mkyaffs2_targets = NULL;
+static unsigned mkyaffs2_ntargets = 0;
+static size_t mkyaffs2_mtd_queue = MTD_FANOUT_QUEUE;
+static struct mtd_fanout mkyaffs2_fanout = {0};
+
+static unsigned mkyaffs2_compress_mode = COMPRESS_NONE;
+static int mkyaffs2_compress_level = -1;
+static struct compress_stream mkyaffs2_compress = {0};
 
 static char mkyaffs2_curfile[PATH_MAX + PATH_MAX] = {0};
 
 static nand_ecclayout_t *mkyaffs2_ecclayout = NULL;
+static nand_ecclayout_t mkyaffs2_syndrome_layout = {0};
 
 static unsigned mkyaffs2_bufsize = 0;
-static unsigned char *mkyaffs2_databuf = NULL;
+static unsigned char *mkyaffs2_databuf = NULL;	/* current page in the batch */
+
+static unsigned mkyaffs2_batch_pages = 0;
+static unsigned char *mkyaffs2_batchbuf = NULL;
+static unsigned char *mkyaffs2_physbuf = NULL;	/* syndrome pages of a batch */
+static unsigned char *mkyaffs2_backbuf = NULL;	/* the batch being written */
+static unsigned char *mkyaffs2_backphys = NULL;
+static unsigned char *mkyaffs2_splitbuf = NULL;	/* data areas of a batch */
+static unsigned char *mkyaffs2_sparebuf = NULL;	/* spare areas of a batch */
+
+static unsigned mkyaffs2_threads = 0;
+static struct thread_pool *mkyaffs2_pool = NULL;
+
+/* writes a batch while the next one is filled and encoded */
+typedef struct mkyaffs2_writer {
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	int running;
+	int exiting;
+	int error;			/* errno of the write failed */
+
+	unsigned char *buf;		/* the batch handed over, or NULL */
+	unsigned char *out;		/* the pages as they go out */
+	unsigned pages;
+} mkyaffs2_writer_t;
+
+static struct mkyaffs2_writer mkyaffs2_writer = {0};
+
+static struct nand_ecc_ctrl mkyaffs2_ecc = {0};
+
+static unsigned mkyaffs2_scramble_seed = 0;
+static unsigned mkyaffs2_scramble_period = 0;
+static struct scrambler mkyaffs2_scrambler = {0};
 
 static struct mkyaffs2_fstree mkyaffs2_objtree = {0};
 static struct list_head mkyaffs2_objtable[MKYAFFS2_OBJTABLE_SIZE];
@@ -199,6 +324,7 @@ mkyaffs2_obj_free (struct mkyaffs2_obj *object)
 	list_del(&object->siblings);
 	list_del(&object->hashlist);
 
+	free(object->data_pages);
 	free(object);
 }
 
@@ -437,13 +563,380 @@ mkyaffs2_assemble_ptags2(unsigned char *spare, struct yaffs_ext_tags *t,
 	return written != sizeof(struct yaffs_packed_tags2);
 }
 
+/* inband tags: the tags part only, at the tail of the page, no ecc */
+static int
+mkyaffs2_assemble_ptags_inband (unsigned char *tail, struct yaffs_ext_tags *t,
+				nand_ecclayout_t *ecclayout, int ecc)
+{
+	struct yaffs_packed_tags2 pt2;
+
+	yaffs_pack_tags2_tags_only(&pt2.t, t);
+
+	if (MKYAFFS2_ISENDIAN)
+		packedtags2_tagspart_endian_convert(&pt2);
+
+	memcpy(tail, &pt2.t, sizeof(struct yaffs_packed_tags2_tags_only));
+
+	return 0;
+}
+
+static void
+mkyaffs2_ecc_page (void *arg, unsigned page)
+{
+	unsigned first = *(unsigned *)arg;
+	unsigned char *buf = mkyaffs2_batchbuf + page * mkyaffs2_bufsize;
+
+	/* the ecc covers the data as it goes to the flash, randomized */
+	if (MKYAFFS2_ISSCRAMBLE)
+		scrambler_page(&mkyaffs2_scrambler, first + page, buf,
+			       buf + mkyaffs2_chunksize, mkyaffs2_sparesize);
+
+	if (mkyaffs2_ecc.mode == NAND_ECC_NONE)
+		return;
+
+	nand_ecc_encode(&mkyaffs2_ecc, buf, buf + mkyaffs2_chunksize);
+
+	/* and the physical page, in the same pass over the batch */
+	if (mkyaffs2_ecc.syndrome)
+		nand_ecc_interleave(&mkyaffs2_ecc, buf, buf + mkyaffs2_chunksize,
+				    mkyaffs2_physbuf + page * mkyaffs2_bufsize);
+}
+
+/* the main and the spare areas of the batch, each to its own file */
+static int
+mkyaffs2_write_split (unsigned char *buf, unsigned pages)
+{
+	unsigned i;
+	size_t datasize = pages * mkyaffs2_chunksize;
+	size_t sparesize = pages * mkyaffs2_sparesize;
+
+	for (i = 0; i < pages; i++, buf += mkyaffs2_bufsize) {
+		memcpy(mkyaffs2_splitbuf + i * mkyaffs2_chunksize, buf,
+		       mkyaffs2_chunksize);
+		memcpy(mkyaffs2_sparebuf + i * mkyaffs2_sparesize,
+		       buf + mkyaffs2_chunksize, mkyaffs2_sparesize);
+	}
+
+	if (safe_write(mkyaffs2_image_fd, mkyaffs2_splitbuf,
+		       datasize) != datasize ||
+	    safe_write(mkyaffs2_spare_fd, mkyaffs2_sparebuf,
+		       sparesize) != sparesize)
+		return -1;
+
+	return 0;
+}
+
+/* 'buf' is the batch, 'out' the same or its syndrome pages */
 static int
-mkyaffs2_write_chunk (unsigned obj_id, unsigned chunk_id, unsigned bytes)
+mkyaffs2_write_batch (unsigned char *buf, unsigned char *out, unsigned pages)
 {
 	ssize_t written;
+	size_t size = pages * mkyaffs2_bufsize;
+
+	/* the pages as they go out, erased or not */
+	if (mkyaffs2_mapfile && page_map_add(&mkyaffs2_pagemap, out,
+					     mkyaffs2_bufsize, pages) < 0) {
+		MKYAFFS2_DEBUG("cannot map %u pages: %s\n",
+				pages, strerror(errno));
+		return -1;
+	}
+
+	if (MKYAFFS2_ISSPARSE)
+		written = sparse_image_write(&mkyaffs2_sparse, out,
+					     pages) ? -1 : size;
+	else if (mkyaffs2_compress_mode != COMPRESS_NONE)
+		written = compress_write(&mkyaffs2_compress,
+					 out, size) ? -1 : size;
+	else if (mkyaffs2_sparefile)
+		written = mkyaffs2_write_split(out, pages) ? -1 : size;
+	else if (MKYAFFS2_ISMTD)	/* the driver lays out syndrome pages */
+		written = mtd_fanout_write(&mkyaffs2_fanout, buf,
+					   out != buf ? out : NULL,
+					   pages) ? -1 : size;
+	else
+		written = safe_write(mkyaffs2_image_fd, out, size);
+	if (written != size) {
+		MKYAFFS2_DEBUG("write %u pages failed: %s\n",
+				pages, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *
+mkyaffs2_writer_thread (void *arg)
+{
+	int error;
+	struct mkyaffs2_writer *w = arg;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (w->buf == NULL && !w->exiting)
+			pthread_cond_wait(&w->cond, &w->lock);
+
+		if (w->buf == NULL)
+			break;
+
+		pthread_mutex_unlock(&w->lock);
+		error = mkyaffs2_write_batch(w->buf, w->out, w->pages) ?
+			errno : 0;
+		pthread_mutex_lock(&w->lock);
+
+		if (error && !w->error)
+			w->error = error;
+		w->buf = NULL;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+/* wait for the batch handed over; -1 when some write has failed */
+static int
+mkyaffs2_writer_wait (struct mkyaffs2_writer *w)
+{
+	int error;
+
+	if (!w->running)
+		return 0;
+
+	pthread_mutex_lock(&w->lock);
+	while (w->buf != NULL)
+		pthread_cond_wait(&w->cond, &w->lock);
+	error = w->error;
+	pthread_mutex_unlock(&w->lock);
+
+	if (error) {
+		errno = error;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+mkyaffs2_writer_start (struct mkyaffs2_writer *w)
+{
+	memset(w, 0, sizeof(struct mkyaffs2_writer));
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+
+	if (pthread_create(&w->tid, NULL, mkyaffs2_writer_thread, w)) {
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->lock);
+		return -1;
+	}
+
+	w->running = 1;
+	return 0;
+}
+
+static void
+mkyaffs2_writer_stop (struct mkyaffs2_writer *w)
+{
+	if (!w->running)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	w->exiting = 1;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->tid, NULL);
+
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->lock);
+	w->running = 0;
+}
+
+static int
+mkyaffs2_flush_pages (void)
+{
+	unsigned char *buf;
+	struct mkyaffs2_writer *w = &mkyaffs2_writer;
+	unsigned first = mkyaffs2_queued_pages - mkyaffs2_batch_pages;
+	unsigned char *out = mkyaffs2_ecc.syndrome ? mkyaffs2_physbuf :
+						     mkyaffs2_batchbuf;
+
+	if (mkyaffs2_batch_pages == 0)
+		return 0;
+
+	/*
+	 * randomizer and ecc of the data area, over the worker threads,
+	 * while the writer is still busy with the batch before.
+	 */
+	if (mkyaffs2_ecc.mode != NAND_ECC_NONE || MKYAFFS2_ISSCRAMBLE)
+		thread_pool_run(mkyaffs2_pool, mkyaffs2_batch_pages,
+				mkyaffs2_ecc_page, &first);
+
+	if (!w->running) {
+		if (mkyaffs2_write_batch(mkyaffs2_batchbuf, out,
+					 mkyaffs2_batch_pages) < 0)
+			return -1;
+	} else {
+		if (mkyaffs2_writer_wait(w) < 0)
+			return -1;
+
+		/* hand the batch over, and fill the other buffers */
+		pthread_mutex_lock(&w->lock);
+		w->buf = mkyaffs2_batchbuf;
+		w->out = out;
+		w->pages = mkyaffs2_batch_pages;
+		pthread_cond_broadcast(&w->cond);
+		pthread_mutex_unlock(&w->lock);
+
+		buf = mkyaffs2_batchbuf;
+		mkyaffs2_batchbuf = mkyaffs2_backbuf;
+		mkyaffs2_backbuf = buf;
+
+		buf = mkyaffs2_physbuf;
+		mkyaffs2_physbuf = mkyaffs2_backphys;
+		mkyaffs2_backphys = buf;
+	}
+
+	mkyaffs2_batch_pages = 0;
+	mkyaffs2_databuf = mkyaffs2_batchbuf;
+
+	return 0;
+}
+
+static int
+mkyaffs2_queue_page (void)
+{
+	/* queue the whole "chunk + spare", written back batch by batch */
+	mkyaffs2_queued_pages++;
+	mkyaffs2_databuf += mkyaffs2_bufsize;
+	if (++mkyaffs2_batch_pages == MKYAFFS2_BATCH_PAGES)
+		return mkyaffs2_flush_pages();
+
+	return 0;
+}
+
+static int
+mkyaffs2_write_tags (struct yaffs_ext_tags *tag)
+{
 	unsigned char *spare = mkyaffs2_databuf + mkyaffs2_chunksize;
 
+	/* write the spare (oob) into the buffer */
+	memset(spare, 0xff, mkyaffs2_sparesize);
+	if (mkyaffs2_assemble_ptags(spare, tag, NULL, 1)) {
+		MKYAFFS2_DEBUG("tag to spare failed for obj %u chunk %u\n",
+				tag->obj_id, tag->chunk_id);
+		return -1;
+	}
+
+	if (mkyaffs2_queue_page()) {
+		MKYAFFS2_DEBUG("write chunk failed for obj %u chunk %u: %s\n",
+				tag->obj_id, tag->chunk_id, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the summary chunks in the rest of the block, as yaffs_summary_write() */
+static int
+mkyaffs2_write_summary (unsigned seq)
+{
+	unsigned i, bytes;
+	unsigned block = mkyaffs2_image_pages / mkyaffs2_pages_per_block;
+	struct yaffs_ext_tags tag;
+
+	memset(&tag, 0, sizeof(struct yaffs_ext_tags));
+	tag.obj_id = YAFFS_OBJECTID_SUMMARY;
+	tag.chunk_used = 1;
+	tag.seq_number = seq;
+
+	for (i = 0; mkyaffs2_image_pages % mkyaffs2_pages_per_block; i++) {
+		memset(mkyaffs2_databuf, 0xff, mkyaffs2_chunksize);
+
+		/* the internal block numbers of the kernel start at 1 */
+		bytes = summary_fill(mkyaffs2_databuf, mkyaffs2_chunksize,
+				     mkyaffs2_summary, mkyaffs2_summary_chunks,
+				     i, block + 1, seq, MKYAFFS2_ISENDIAN);
+
+		tag.chunk_id = i + 1;
+		tag.n_bytes = bytes;
+
+		mkyaffs2_image_pages++;
+
+		if (mkyaffs2_write_tags(&tag))
+			return -1;
+	}
+
+	memset(mkyaffs2_summary, 0, sizeof(struct summary_tags) *
+				    mkyaffs2_summary_chunks);
+
+	return 0;
+}
+
+/* erased pages up to the next block, so what follows starts a block */
+static int
+mkyaffs2_pad_block (void)
+{
+	unsigned ppb = mkyaffs2_pages_per_block;
+	unsigned block = mkyaffs2_image_pages / ppb;
+
+	if (mkyaffs2_image_pages % ppb == 0)
+		return 0;
+
+	if (block < mkyaffs2_padding_blocks)
+		mkyaffs2_padding[block] = ppb - mkyaffs2_image_pages % ppb;
+
+	/* the kernel keeps the summary for the full blocks only */
+	if (mkyaffs2_summary_chunks) {
+		memset(mkyaffs2_summary, 0, sizeof(struct summary_tags) *
+					    mkyaffs2_summary_chunks);
+	}
+
+	while (mkyaffs2_image_pages % ppb) {
+		memset(mkyaffs2_databuf, 0xff, mkyaffs2_bufsize);
+		mkyaffs2_image_pages++;
+		mkyaffs2_pad_pages++;
+		if (mkyaffs2_queue_page())
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * The small files of a directory share a block: they go to the next one
+ * when they fit in a block, but not in the rest of the current one.
+ */
+static int
+mkyaffs2_align_group (struct mkyaffs2_obj *dir)
+{
+	unsigned pages = 0, room;
+	unsigned ppb = mkyaffs2_pages_per_block;
+	struct list_head *p;
+	struct mkyaffs2_obj *obj;
+
+	list_for_each(p, &dir->children) {
+		obj = list_entry(p, mkyaffs2_obj_t, siblings);
+		if (obj->layout == MKYAFFS2_LAYOUT_SMALL)
+			pages += obj->pages;
+	}
+
+	/* the summary takes the tail of a block */
+	if (mkyaffs2_summary_chunks)
+		ppb = mkyaffs2_summary_chunks;
+	room = ppb - mkyaffs2_image_pages % mkyaffs2_pages_per_block;
+
+	if (pages > room && pages <= ppb)
+		return mkyaffs2_pad_block();
+
+	return 0;
+}
+
+static int
+mkyaffs2_write_chunk (unsigned obj_id, unsigned chunk_id, unsigned bytes,
+		      const struct yaffs_obj_hdr *oh)
+{
+	unsigned index = 0;
 	struct yaffs_ext_tags tag;
+	struct yaffs_packed_tags2_tags_only pt;
 
 	/* prepare the spare (oob) first */
 	memset(&tag, 0, sizeof(struct yaffs_ext_tags));
@@ -461,50 +954,152 @@ mkyaffs2_write_chunk (unsigned obj_id, unsigned chunk_id, unsigned bytes)
 	tag.chunk_used = 1;
 	tag.seq_number = YAFFS_LOWEST_SEQUENCE_NUMBER;
 
+	/* the kernel allocator hands out LOWEST + 1 to the first block */
+	if (mkyaffs2_pages_per_block) {
+		tag.seq_number += 1 + mkyaffs2_image_pages /
+				      mkyaffs2_pages_per_block;
+	}
 
-	/* write the spare (oob) into the buffer */
-	memset(spare, 0xff, mkyaffs2_sparesize);
-	if (mkyaffs2_assemble_ptags(spare, &tag, NULL, 1)) {
-		MKYAFFS2_DEBUG("tag to spare failed for obj %u chunk %u\n",
-				obj_id, chunk_id);
-		return -1;
+	/*
+	 * yaffs2 only: keep the parent, type and size of an object in the
+	 * tags of its header, so the kernel scans the image by the oob only.
+	 */
+	if (oh) {
+		tag.extra_available = 1;
+		tag.extra_parent_id = oh->parent_obj_id;
+		tag.extra_obj_type = oh->type;
+		tag.extra_is_shrink = 0;
+		tag.extra_shadows = oh->shadows_obj > 0 ? 1 : 0;
+
+		if (oh->type == YAFFS_OBJECT_TYPE_HARDLINK) {
+			tag.extra_equiv_id = oh->equiv_id;
+		}
+		else if (oh->type == YAFFS_OBJECT_TYPE_FILE) {
+			tag.extra_file_size = oh->file_size_low;
+			if (oh->file_size_high != 0xffffffff)
+				tag.extra_file_size |=
+					(loff_t)oh->file_size_high << 32;
+		}
 	}
 
-	/* write a whole "chunk + spare" back to the image */
-	written = safe_write(mkyaffs2_image_fd,
-			     mkyaffs2_databuf, mkyaffs2_bufsize);
-	if (written != mkyaffs2_bufsize) {
-		MKYAFFS2_DEBUG("write chunk failed for obj %u chunk %u: %s\n",
-				obj_id, chunk_id, strerror(errno));
-		return -1;
+	/* the summary takes the tags as they are packed into the oob */
+	if (mkyaffs2_summary_chunks) {
+		index = mkyaffs2_image_pages % mkyaffs2_pages_per_block;
+		yaffs_pack_tags2_tags_only(&pt, &tag);
+		mkyaffs2_summary[index].obj_id = pt.obj_id;
+		mkyaffs2_summary[index].chunk_id = pt.chunk_id;
+		mkyaffs2_summary[index].n_bytes = pt.n_bytes;
 	}
 
 	mkyaffs2_image_pages++;
 
+	if (mkyaffs2_write_tags(&tag))
+		return -1;
+
+	/* the block is full of data, close it with the summary */
+	if (mkyaffs2_summary_chunks && index == mkyaffs2_summary_chunks - 1)
+		return mkyaffs2_write_summary(tag.seq_number);
+
 	return 0;
 }
 
 static int 
 mkyaffs2_write_oh (struct yaffs_obj_hdr *oh, struct mkyaffs2_obj *obj)
 {
-	if (MKYAFFS2_ISENDIAN)
- 	   	oh_endian_convert(oh);
-
 	/* copy header into the buffer */
 	memset(mkyaffs2_databuf, 0xff, mkyaffs2_chunksize);
 	memcpy(mkyaffs2_databuf, oh, sizeof(struct yaffs_obj_hdr));
 
+	/* the tags are built from the header in the host byte order */
+	if (MKYAFFS2_ISENDIAN)
+ 	   	oh_endian_convert((struct yaffs_obj_hdr *)mkyaffs2_databuf);
+
 	/* write buffer */
-	return mkyaffs2_write_chunk(obj->obj_id, 0, 0xffff);
+	obj->hdr_page = mkyaffs2_image_pages;
+	return mkyaffs2_write_chunk(obj->obj_id, 0, 0xffff, oh);
+}
+
+static inline unsigned
+mkyaffs2_roundup_pow2 (unsigned n)
+{
+	unsigned size = 1;
+
+	while (size < n)
+		size <<= 1;
+
+	return n ? size : 0;
+}
+
+/* remember the page a data chunk of a file goes to, holes skipped */
+static int
+mkyaffs2_add_data_page (struct mkyaffs2_obj *obj, unsigned chunk)
+{
+	unsigned *pages, size;
+
+	/* grown by powers of two */
+	size = mkyaffs2_roundup_pow2(chunk);
+	if (size > mkyaffs2_roundup_pow2(obj->last_chunk)) {
+		pages = realloc(obj->data_pages, size * sizeof(unsigned));
+		if (pages == NULL)
+			return -1;
+		obj->data_pages = pages;
+	}
+
+	while (obj->last_chunk < chunk - 1)
+		obj->data_pages[obj->last_chunk++] = CHECKPT_NO_PAGE;
+
+	obj->data_pages[obj->last_chunk++] = mkyaffs2_image_pages;
+
+	return 0;
+}
+
+static inline int
+mkyaffs2_iszero (const unsigned char *buf, size_t size)
+{
+	while (size--) {
+		if (*buf++)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * The next chunk holding data of a sparse file, from 'chunk' on; its hole
+ * is read as zeros by the kernel. Returns 0 when the rest is a hole.
+ */
+static int
+mkyaffs2_seek_data (int fd, unsigned *chunk, off_t *hole)
+{
+#ifdef _HAVE_SEEK_HOLE
+	off_t data, offset = (off_t)*chunk * mkyaffs2_chunksize;
+
+	data = lseek(fd, offset, SEEK_DATA);
+	if (data < 0 && errno == ENXIO)
+		return 0;
+
+	if (data < 0 || (*hole = lseek(fd, data, SEEK_HOLE)) < 0) {
+		/* no holes known by the file system */
+		*hole = (off_t)~0ULL >> 1;
+		data = offset;
+	}
+
+	*chunk = data / mkyaffs2_chunksize;
+	if (lseek(fd, (off_t)*chunk * mkyaffs2_chunksize, SEEK_SET) < 0)
+		return -1;
+#else
+	*hole = (off_t)~0ULL >> 1;
+#endif
+
+	return 1;
 }
 
 static int 
 mkyaffs2_write_regfile (const char *fpath, struct mkyaffs2_obj *obj)
 {
 	int fd, retval = 0;
-	unsigned chunk = 0;
-	unsigned char *databuf = mkyaffs2_databuf;
+	unsigned chunk = 0, next;
 	ssize_t bytes;
+	off_t hole = 0;
 
 	fd = open(fpath, O_RDONLY);
 	if (fd < 0) {
@@ -512,8 +1107,34 @@ mkyaffs2_write_regfile (const char *fpath, struct mkyaffs2_obj *obj)
 		return -1;
 	}
 
-	memset(databuf, 0xff, mkyaffs2_chunksize);
-	while((bytes = safe_read(fd, databuf, mkyaffs2_chunksize)) != 0) {
+	for (;;) {
+		/* the chunks lying in a hole are not written at all */
+		if ((off_t)chunk * mkyaffs2_chunksize >= hole) {
+			next = chunk;
+			retval = mkyaffs2_seek_data(fd, &next, &hole);
+			if (retval < 0) {
+				MKYAFFS2_DEBUG("cannot seek the file '%s': "
+					       "%s\n", fpath, strerror(errno));
+				break;
+			}
+
+			/* a hole up to the end of the file */
+			if (retval == 0) {
+				mkyaffs2_hole_chunks += (obj->size_or_equiv +
+					mkyaffs2_chunksize - 1) /
+					mkyaffs2_chunksize - chunk;
+				break;
+			}
+			mkyaffs2_hole_chunks += next - chunk;
+			chunk = next;
+			retval = 0;
+		}
+
+		memset(mkyaffs2_databuf, 0xff, mkyaffs2_chunksize);
+		bytes = safe_read(fd, mkyaffs2_databuf, mkyaffs2_chunksize);
+		if (bytes == 0)
+			break;
+
 		if (bytes < 0) {
 			MKYAFFS2_DEBUG("error while reading file '%s': %s\n",
 					fpath, strerror(errno));
@@ -521,15 +1142,29 @@ mkyaffs2_write_regfile (const char *fpath, struct mkyaffs2_obj *obj)
 			break;
 		}
 
+		chunk++;
+
+		/* a chunk of zeros reads back the same when left out */
+		if (MKYAFFS2_ISSKIPZERO &&
+		    mkyaffs2_iszero(mkyaffs2_databuf, bytes)) {
+			mkyaffs2_hole_chunks++;
+			continue;
+		}
+
 		/* write buffer */
-		retval = mkyaffs2_write_chunk(obj->obj_id, ++chunk, bytes);
+		if (MKYAFFS2_ISCHECKPT && mkyaffs2_add_data_page(obj, chunk)) {
+			retval = -1;
+			break;
+		}
+
+		retval = mkyaffs2_write_chunk(obj->obj_id, chunk, bytes,
+					      NULL);
 		if (retval) {
 			MKYAFFS2_DEBUG("error while writing file '%s': %s\n",
 					fpath, strerror(errno));
 			break;
 		}
-
-		memset(databuf, 0xff, mkyaffs2_chunksize);
+		obj->data_chunks++;
 	}
 
 	close(fd);
@@ -563,10 +1198,45 @@ mkyaffs2_scan_dir_status (unsigned status)
 	fflush(stdout);
 }
 
-static int
-mkyaffs2_scan_dir (struct mkyaffs2_obj *parent)
+/*
+ * Add an object to its directory. For the aligned layout, the small files
+ * go first, then the large files and the subdirectories at last.
+ */
+static void
+mkyaffs2_layout_insert (struct mkyaffs2_obj *parent, struct mkyaffs2_obj *obj,
+			const struct stat *s)
 {
-	int retval = 0;
+	struct list_head *p = &parent->children;
+	struct mkyaffs2_obj *sibling;
+
+	if (MKYAFFS2_ISALIGNED) {
+		obj->pages = 1;
+		obj->layout = MKYAFFS2_LAYOUT_SMALL;
+
+		if (S_ISDIR(s->st_mode)) {
+			obj->layout = MKYAFFS2_LAYOUT_DIR;
+		}
+		else if (S_ISREG(s->st_mode)) {
+			obj->pages += (s->st_size + mkyaffs2_chunksize - 1) /
+				      mkyaffs2_chunksize;
+			if (s->st_size >= mkyaffs2_align_size)
+				obj->layout = MKYAFFS2_LAYOUT_LARGE;
+		}
+
+		list_for_each(p, &parent->children) {
+			sibling = list_entry(p, mkyaffs2_obj_t, siblings);
+			if (sibling->layout > obj->layout)
+				break;
+		}
+	}
+
+	list_add_tail(&obj->siblings, p);
+}
+
+static int
+mkyaffs2_scan_dir (struct mkyaffs2_obj *parent)
+{
+	int retval = 0;
 	DIR *dir;
 	struct stat s;
 	struct dirent *dent;
@@ -601,11 +1271,14 @@ mkyaffs2_scan_dir (struct mkyaffs2_obj *parent)
 
 		strncpy(obj->name, dent->d_name, NAME_MAX);
 		obj->parent_obj = parent;
-		list_add_tail(&obj->siblings, &parent->children);
+
+		if (lstat(mkyaffs2_curfile, &s) < 0)
+			memset(&s, 0, sizeof(struct stat));
+		mkyaffs2_layout_insert(parent, obj, &s);
 
 		mkyaffs2_scan_dir_status(++mkyaffs2_objtree.objs);
 
-		if (!lstat(mkyaffs2_curfile, &s) && S_ISDIR(s.st_mode))
+		if (S_ISDIR(s.st_mode))
 			retval = mkyaffs2_scan_dir(obj);
 
 		if (!strcmp(dirname(mkyaffs2_curfile), "."))
@@ -640,17 +1313,30 @@ mkyaffs2_write_obj (const char *fpath, struct mkyaffs2_obj *obj)
 	obj->dev = s.st_dev;
 	obj->ino = s.st_ino;
 
-	/* hardlink? */
+	/* hardlink? or a copy of an earlier file */
 	equiv_obj = mkyaffs2_objtable_find(obj->dev, obj->ino);
+	if (equiv_obj == NULL && S_ISREG(s.st_mode) && obj->dedup_obj) {
+		equiv_obj = obj->dedup_obj;
+		mkyaffs2_dedup_objs++;
+		mkyaffs2_dedup_bytes += (unsigned long long)
+					equiv_obj->data_chunks *
+					mkyaffs2_bufsize;
+	}
 	if (equiv_obj) {
 		obj->type = YAFFS_OBJECT_TYPE_HARDLINK;
+		obj->size_or_equiv = equiv_obj->obj_id;
 		oh.equiv_id = equiv_obj->obj_id;
 		goto write_obj;
 	}
 
 	switch (s.st_mode & S_IFMT) {
 	case S_IFREG:
+		if (MKYAFFS2_ISALIGNED && s.st_size >= mkyaffs2_align_size &&
+		    mkyaffs2_pad_block())
+			return -1;
+
 		obj->type = YAFFS_OBJECT_TYPE_FILE;
+		obj->size_or_equiv = s.st_size;
 		oh.file_size_low = s.st_size & 0xFFFFFFFF;
 #if __WORDSIZE == 64 || !defined __USE_FILE_OFFSET64
 		oh.file_size_high = 0xffffffff;
@@ -805,11 +1491,14 @@ next:
 				  " (skip)" : "");
 
 		if (obj->type == YAFFS_OBJECT_TYPE_DIRECTORY) {
+			if (MKYAFFS2_ISALIGNED)
+				retval = mkyaffs2_align_group(obj);
+
 			list_for_each(p, &obj->children) {
-				child = list_entry(p, mkyaffs2_obj_t, siblings);
-				retval = mkyaffs2_assemble_objtree(child);
 				if (retval)
 					break;
+				child = list_entry(p, mkyaffs2_obj_t, siblings);
+				retval = mkyaffs2_assemble_objtree(child);
 			}
 		}
 	}
@@ -823,6 +1512,102 @@ next:
 
 /*----------------------------------------------------------------------------*/
 
+/* the regular files, in the order mkyaffs2_assemble_objtree() visits them */
+static int
+mkyaffs2_dedup_collect (struct mkyaffs2_obj *dir, char *path, size_t len)
+{
+	struct stat s;
+	struct list_head *p;
+	struct mkyaffs2_obj *obj;
+	struct dedup_file *list, *f;
+
+	list_for_each(p, &dir->children) {
+		obj = list_entry(p, mkyaffs2_obj_t, siblings);
+
+		snprintf(path + len, PATH_MAX + PATH_MAX - len, "/%s",
+			 obj->name);
+		if (lstat(path, &s) < 0)
+			continue;
+
+		if (S_ISDIR(s.st_mode)) {
+			if (mkyaffs2_dedup_collect(obj, path,
+						   len + strlen(path + len)))
+				return -1;
+			continue;
+		}
+
+		if (!S_ISREG(s.st_mode) || s.st_size == 0)
+			continue;
+
+		/* grown by powers of two */
+		if ((mkyaffs2_dedup_n & (mkyaffs2_dedup_n - 1)) == 0) {
+			list = realloc(mkyaffs2_dedup_list, (mkyaffs2_dedup_n ?
+				       mkyaffs2_dedup_n * 2 : 1) *
+				       sizeof(struct dedup_file));
+			if (list == NULL)
+				return -1;
+			mkyaffs2_dedup_list = list;
+		}
+
+		f = &mkyaffs2_dedup_list[mkyaffs2_dedup_n];
+		memset(f, 0, sizeof(struct dedup_file));
+		f->path = strdup(path);
+		if (f->path == NULL)
+			return -1;
+		mkyaffs2_dedup_n++;
+
+		f->size = s.st_size;
+		f->mode = s.st_mode;
+		f->uid = MKYAFFS2_ISALLROOT ? 0 : s.st_uid;
+		f->gid = MKYAFFS2_ISALLROOT ? 0 : s.st_gid;
+		f->priv = obj;
+	}
+
+	return 0;
+}
+
+/* files of the same content become hardlinks to the first of them */
+static int
+mkyaffs2_dedup (const char *dirpath)
+{
+	int retval = -1;
+	unsigned i;
+	char path[PATH_MAX + PATH_MAX];
+	struct dedup_file *f;
+	struct mkyaffs2_obj *obj;
+
+	snprintf(path, sizeof(path), "%s", dirpath);
+	if (mkyaffs2_dedup_collect(mkyaffs2_objtree.root, path, strlen(path)) ||
+	    dedup_files(mkyaffs2_dedup_list, mkyaffs2_dedup_n,
+			mkyaffs2_pool) < 0) {
+		MKYAFFS2_ERROR("cannot deduplicate the files: %s\n",
+				strerror(errno));
+		goto free_and_out;
+	}
+
+	for (i = 0; i < mkyaffs2_dedup_n; i++) {
+		f = &mkyaffs2_dedup_list[i];
+		if (f->equiv < 0)
+			continue;
+
+		obj = f->priv;
+		obj->dedup_obj = mkyaffs2_dedup_list[f->equiv].priv;
+	}
+
+	retval = 0;
+
+free_and_out:
+	for (i = 0; i < mkyaffs2_dedup_n; i++)
+		free((char *)mkyaffs2_dedup_list[i].path);
+	free(mkyaffs2_dedup_list);
+	mkyaffs2_dedup_list = NULL;
+	mkyaffs2_dedup_n = 0;
+
+	return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+
 static int
 mkyaffs2_load_spare (const char *oobfile)
 {
@@ -851,10 +1636,187 @@ mkyaffs2_load_spare (const char *oobfile)
 
 /*----------------------------------------------------------------------------*/
 
+static int
+mkyaffs2_checkpt_objs (struct checkpt *cp, struct mkyaffs2_obj *dir)
+{
+	struct list_head *p;
+	struct checkpt_obj c;
+	struct mkyaffs2_obj *obj;
+
+	list_for_each(p, &dir->children) {
+		obj = list_entry(p, mkyaffs2_obj_t, siblings);
+		if (obj->type == YAFFS_OBJECT_TYPE_UNKNOWN)
+			continue;
+
+		memset(&c, 0, sizeof(struct checkpt_obj));
+		c.obj_id = obj->obj_id;
+		c.parent_id = dir->obj_id;
+		c.type = (obj->type > YAFFS_OBJECT_TYPE_SPECIAL) ?
+			 YAFFS_OBJECT_TYPE_SPECIAL : obj->type;
+		c.hdr_page = obj->hdr_page;
+		c.data_pages = obj->data_pages;
+		c.last_chunk = obj->last_chunk;
+		c.n_data_chunks = obj->data_chunks;
+		c.size_or_equiv = obj->size_or_equiv;
+
+		if (checkpt_add_obj(cp, &c))
+			return -1;
+
+		if (obj->type == YAFFS_OBJECT_TYPE_DIRECTORY &&
+		    mkyaffs2_checkpt_objs(cp, obj))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* write the checkpoint into the erased blocks right after the data */
+static int
+mkyaffs2_write_checkpt (void)
+{
+	int retval = -1;
+	size_t offset, bytes;
+	unsigned i, pages, block;
+	unsigned ppb = mkyaffs2_pages_per_block;
+	unsigned blocks = mkyaffs2_partition_size / mkyaffs2_pagesize / ppb;
+
+	struct checkpt cp;
+	struct yaffs_ext_tags tag;
+
+	checkpt_init(&cp, ppb, blocks, mkyaffs2_image_pages,
+		     MKYAFFS2_ISENDIAN, mkyaffs2_checkpt_ptr);
+	cp.summary = mkyaffs2_summary_chunks != 0;
+	cp.padding = mkyaffs2_padding;
+
+	if (mkyaffs2_checkpt_objs(&cp, mkyaffs2_objtree.root) ||
+	    checkpt_build(&cp)) {
+		MKYAFFS2_ERROR("cannot build the checkpoint: %s\n",
+				strerror(errno));
+		goto free_and_out;
+	}
+
+	pages = (cp.len + mkyaffs2_chunksize - 1) / mkyaffs2_chunksize;
+	block = (mkyaffs2_image_pages + ppb - 1) / ppb;
+	mkyaffs2_checkpt_blocks = (pages + ppb - 1) / ppb;
+
+	if (mkyaffs2_checkpt_blocks > checkpt_max_blocks(&cp) ||
+	    block + mkyaffs2_checkpt_blocks > blocks) {
+		MKYAFFS2_ERROR("no room for the checkpoint (%u blocks).\n",
+				mkyaffs2_checkpt_blocks);
+		goto free_and_out;
+	}
+
+	/* the rest of the last data block stays erased */
+	for (i = mkyaffs2_queued_pages; i < block * ppb; i++) {
+		memset(mkyaffs2_databuf, 0xff, mkyaffs2_bufsize);
+		if (mkyaffs2_queue_page())
+			goto error;
+	}
+
+	for (i = 0, offset = 0; i < pages; i++, offset += bytes) {
+		bytes = cp.len - offset < mkyaffs2_chunksize ?
+			cp.len - offset : mkyaffs2_chunksize;
+
+		memset(mkyaffs2_databuf, 0, mkyaffs2_chunksize);
+		memcpy(mkyaffs2_databuf, cp.data + offset, bytes);
+
+		/*
+		 * as yaffs2_checkpt_flush_buffer() does, the obj_id hints
+		 * the (internal) block to look for the next part.
+		 */
+		memset(&tag, 0, sizeof(struct yaffs_ext_tags));
+		tag.obj_id = block + i / ppb + 2;
+		tag.chunk_id = i + 1;
+		tag.n_bytes = mkyaffs2_chunksize;
+		tag.chunk_used = 1;
+		tag.seq_number = CHECKPT_SEQUENCE;
+
+		if (mkyaffs2_write_tags(&tag))
+			goto error;
+	}
+
+	retval = 0;
+	goto free_and_out;
+
+error:
+	MKYAFFS2_ERROR("write checkpoint failed: %s\n", strerror(errno));
+free_and_out:
+	checkpt_release(&cp);
+	return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* fill up the last block, and then the partition, with erased pages */
+static int
+mkyaffs2_pad_image (void)
+{
+	unsigned long long pages = mkyaffs2_queued_pages, total = pages;
+
+	if (mkyaffs2_pages_per_block) {
+		total = (pages + mkyaffs2_pages_per_block - 1) /
+			mkyaffs2_pages_per_block * mkyaffs2_pages_per_block;
+	}
+
+	if (mkyaffs2_partition_size) {
+		if (total * mkyaffs2_pagesize > mkyaffs2_partition_size) {
+			MKYAFFS2_ERROR("image (%llu pages) exceeds the "
+				       "partition size (%llu bytes).\n",
+				       total, mkyaffs2_partition_size);
+			return -1;
+		}
+		total = mkyaffs2_partition_size / mkyaffs2_pagesize;
+	}
+
+	if (mkyaffs2_pages_per_block)
+		mkyaffs2_image_blocks = total / mkyaffs2_pages_per_block;
+
+	for (; pages < total; pages++) {
+		memset(mkyaffs2_databuf, 0xff, mkyaffs2_bufsize);
+		if (mkyaffs2_queue_page())
+			goto error;
+	}
+
+	if (mkyaffs2_flush_pages() || mkyaffs2_writer_wait(&mkyaffs2_writer))
+		goto error;
+
+	return 0;
+
+error:
+	MKYAFFS2_ERROR("write image failed: %s\n", strerror(errno));
+	return -1;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* the slowest of the devices still going */
+static void
+mkyaffs2_mtd_progress (unsigned long long pages, unsigned long long total)
+{
+	if (total)
+		MKYAFFS2_PROGRESS_BAR(pages, total);
+}
+
+static int
+mkyaffs2_write_pagemap (const char *mapfile)
+{
+	int fd, retval;
+
+	fd = open(mapfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+
+	retval = page_map_save(&mkyaffs2_pagemap, fd);
+	close(fd);
+
+	return retval;
+}
+
 static int
 mkyaffs2_create_image (const char *dirpath, const char *imgfile)
 {
 	int retval;
+	unsigned i;
 	struct stat statbuf;
 	struct mkyaffs2_obj *root;
 
@@ -877,22 +1839,167 @@ mkyaffs2_create_image (const char *dirpath, const char *imgfile)
 
 	/* allocate working buffer */
 	mkyaffs2_bufsize = mkyaffs2_chunksize + mkyaffs2_sparesize;
-	mkyaffs2_databuf = (unsigned char *)malloc(mkyaffs2_bufsize);
-	if (mkyaffs2_databuf == NULL) {
+	mkyaffs2_batchbuf = (unsigned char *)malloc(mkyaffs2_bufsize *
+						    MKYAFFS2_BATCH_PAGES);
+	if (mkyaffs2_batchbuf == NULL) {
 		MKYAFFS2_ERROR("cannot allocate working buffer (%u bytes): %s",
-				mkyaffs2_chunksize + mkyaffs2_sparesize,
+				mkyaffs2_bufsize * MKYAFFS2_BATCH_PAGES,
 				strerror(errno));
 		retval = -1;
 		goto exit_and_out;
 	}
+	mkyaffs2_databuf = mkyaffs2_batchbuf;
+	mkyaffs2_batch_pages = 0;
+
+	if (mkyaffs2_ecc.syndrome) {
+		mkyaffs2_physbuf = malloc(mkyaffs2_bufsize *
+					  MKYAFFS2_BATCH_PAGES);
+		if (mkyaffs2_physbuf == NULL) {
+			MKYAFFS2_ERROR("cannot allocate the syndrome buffer: "
+				       "%s", strerror(errno));
+			retval = -1;
+			goto free_and_out;
+		}
+	}
+
+	/* a second batch, encoded while the first one is written */
+	if (mkyaffs2_ecc.mode != NAND_ECC_NONE || MKYAFFS2_ISSCRAMBLE) {
+		mkyaffs2_backbuf = malloc(mkyaffs2_bufsize *
+					  MKYAFFS2_BATCH_PAGES);
+		if (mkyaffs2_ecc.syndrome)
+			mkyaffs2_backphys = malloc(mkyaffs2_bufsize *
+						   MKYAFFS2_BATCH_PAGES);
+		if (mkyaffs2_backbuf == NULL ||
+		    (mkyaffs2_ecc.syndrome && mkyaffs2_backphys == NULL)) {
+			MKYAFFS2_ERROR("cannot allocate the second batch: %s",
+					strerror(errno));
+			retval = -1;
+			goto free_and_out;
+		}
+	}
 
-	mkyaffs2_image_fd = open(imgfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-	if (mkyaffs2_image_fd < 0) {
-		MKYAFFS2_ERROR("cannot open the image file: '%s'.\n", imgfile);
+	if (mkyaffs2_sparefile) {
+		mkyaffs2_splitbuf = malloc(mkyaffs2_chunksize *
+					   MKYAFFS2_BATCH_PAGES);
+		mkyaffs2_sparebuf = malloc(mkyaffs2_sparesize *
+					   MKYAFFS2_BATCH_PAGES);
+		if (mkyaffs2_splitbuf == NULL || mkyaffs2_sparebuf == NULL) {
+			MKYAFFS2_ERROR("cannot allocate the split buffers: %s",
+					strerror(errno));
+			retval = -1;
+			goto free_and_out;
+		}
+	}
+
+	/* the checkpoint tells the padded blocks */
+	if (MKYAFFS2_ISALIGNED && MKYAFFS2_ISCHECKPT) {
+		mkyaffs2_padding_blocks = mkyaffs2_partition_size /
+					  mkyaffs2_pagesize /
+					  mkyaffs2_pages_per_block;
+		mkyaffs2_padding = calloc(mkyaffs2_padding_blocks,
+					  sizeof(unsigned));
+		if (mkyaffs2_padding == NULL) {
+			MKYAFFS2_ERROR("cannot allocate the padding: %s",
+					strerror(errno));
+			retval = -1;
+			goto free_and_out;
+		}
+	}
+
+	if (mkyaffs2_summary_chunks) {
+		mkyaffs2_summary = calloc(mkyaffs2_summary_chunks,
+					  sizeof(struct summary_tags));
+		if (mkyaffs2_summary == NULL) {
+			MKYAFFS2_ERROR("cannot allocate the summary: %s",
+					strerror(errno));
+			retval = -1;
+			goto free_and_out;
+		}
+	}
+
+	if ((mkyaffs2_ecc.mode != NAND_ECC_NONE || MKYAFFS2_ISDEDUP ||
+	     MKYAFFS2_ISSCRAMBLE || mkyaffs2_compress_mode != COMPRESS_NONE) &&
+	    mkyaffs2_threads > 1) {
+		mkyaffs2_pool = thread_pool_create(mkyaffs2_threads);
+		if (mkyaffs2_pool == NULL)
+			MKYAFFS2_WARN("warning: no worker threads, "
+				      "running serially.\n");
+	}
+
+	/* the pages go to the devices (opened by main) block by block */
+	if (MKYAFFS2_ISMTD) {
+		if (mtd_fanout_start(&mkyaffs2_fanout, mkyaffs2_targets,
+				     mkyaffs2_ntargets,
+				     MKYAFFS2_ISINBAND ? mkyaffs2_bufsize :
+							 mkyaffs2_chunksize,
+				     MKYAFFS2_ISINBAND ? 0 : mkyaffs2_sparesize,
+				     mkyaffs2_ecc.mode != NAND_ECC_NONE,
+				     MKYAFFS2_BATCH_PAGES,
+				     mkyaffs2_mtd_queue)) {
+			MKYAFFS2_ERROR("cannot program the devices: %s\n",
+					strerror(errno));
+			retval = -1;
+			goto free_and_out;
+		}
+	}
+	/* already there when streaming to stdout */
+	else if (mkyaffs2_image_fd < 0) {
+		mkyaffs2_image_fd = open(imgfile, O_WRONLY | O_CREAT | O_TRUNC,
+					 0644);
+		if (mkyaffs2_image_fd < 0) {
+			MKYAFFS2_ERROR("cannot open the image file: '%s'.\n",
+					imgfile);
+			retval = -1;
+			goto free_and_out;
+		}
+	}
+
+	if (mkyaffs2_sparefile) {
+		mkyaffs2_spare_fd = open(mkyaffs2_sparefile,
+					 O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (mkyaffs2_spare_fd < 0) {
+			MKYAFFS2_ERROR("cannot open the spare file: '%s'.\n",
+					mkyaffs2_sparefile);
+			retval = -1;
+			goto free_and_out;
+		}
+	}
+
+	/* the sparse header is written back at the end */
+	if (MKYAFFS2_ISSPARSE && lseek(mkyaffs2_image_fd, 0, SEEK_CUR) < 0) {
+		MKYAFFS2_ERROR("sparse image needs a seekable output, "
+			       "not a pipe.\n");
+		retval = -1;
+		goto free_and_out;
+	}
+
+	/* a block of the sparse image is a whole page, with its spare */
+	if (MKYAFFS2_ISSPARSE && sparse_image_start(&mkyaffs2_sparse,
+						    mkyaffs2_image_fd,
+						    mkyaffs2_bufsize)) {
+		MKYAFFS2_ERROR("cannot start the sparse image: %s\n",
+				strerror(errno));
+		retval = -1;
+		goto free_and_out;
+	}
+
+	/* a frame for every worker thread, compressed at once */
+	if (mkyaffs2_compress_mode != COMPRESS_NONE &&
+	    compress_start(&mkyaffs2_compress, mkyaffs2_image_fd,
+			   mkyaffs2_compress_mode, mkyaffs2_compress_level,
+			   mkyaffs2_threads, mkyaffs2_pool)) {
+		MKYAFFS2_ERROR("cannot start the compression: %s\n",
+				strerror(errno));
 		retval = -1;
 		goto free_and_out;
 	}
 
+	/* the output is written by its own thread, behind the ecc */
+	if (mkyaffs2_backbuf != NULL &&
+	    mkyaffs2_writer_start(&mkyaffs2_writer) < 0)
+		MKYAFFS2_WARN("warning: no writer thread, "
+			      "writing after the ecc.\n");
+
 	/* stage 1: scanning direcotry */
 	snprintf(mkyaffs2_curfile, PATH_MAX, "%s", dirpath);
 	MKYAFFS2_PRINTF("\n");
@@ -906,6 +2013,13 @@ mkyaffs2_create_image (const char *dirpath, const char *imgfile)
 	MKYAFFS2_PRINTF("\b\b\b[done]\nscanning complete, total objects: %u.\n",
 			mkyaffs2_objtree.objs);
 
+	if (MKYAFFS2_ISDEDUP) {
+		MKYAFFS2_PRINTF("deduplicating the files...\n");
+		retval = mkyaffs2_dedup(dirpath);
+		if (retval < 0)
+			goto free_and_out;
+	}
+
 	/* stage 2: making a image */
 	MKYAFFS2_PRINTF("\n");
 	MKYAFFS2_PRINTF("stage 2: creating image '%s'\n", imgfile);
@@ -914,11 +2028,55 @@ mkyaffs2_create_image (const char *dirpath, const char *imgfile)
 
 	snprintf(mkyaffs2_curfile, PATH_MAX, "%s", dirpath);
 	retval = mkyaffs2_assemble_objtree(mkyaffs2_objtree.root);
+	if (!retval && MKYAFFS2_ISCHECKPT)
+		retval = mkyaffs2_write_checkpt();
+	if (!retval)
+		retval = mkyaffs2_pad_image();
+	if (!retval && MKYAFFS2_ISSPARSE &&
+	    sparse_image_finish(&mkyaffs2_sparse)) {
+		MKYAFFS2_ERROR("write the sparse header failed: %s\n",
+				strerror(errno));
+		retval = -1;
+	}
+	if (!retval && mkyaffs2_compress_mode != COMPRESS_NONE &&
+	    compress_finish(&mkyaffs2_compress)) {
+		MKYAFFS2_ERROR("write the compressed image failed: %s\n",
+				strerror(errno));
+		retval = -1;
+	}
+	if (MKYAFFS2_ISMTD && mkyaffs2_fanout.targets != NULL) {
+		MKYAFFS2_PRINTF("\nprogramming %u devices...\n",
+				mkyaffs2_ntargets);
+		if (mtd_fanout_finish(&mkyaffs2_fanout,
+				      mkyaffs2_mtd_progress) < 0)
+			retval = -1;
+	}
+	if (!retval && mkyaffs2_mapfile &&
+	    mkyaffs2_write_pagemap(mkyaffs2_mapfile) < 0) {
+		MKYAFFS2_ERROR("write the page map '%s' failed: %s\n",
+				mkyaffs2_mapfile, strerror(errno));
+		retval = -1;
+	}
 
 free_and_out:
+	mkyaffs2_writer_stop(&mkyaffs2_writer);
+	compress_release(&mkyaffs2_compress);
+	mtd_fanout_release(&mkyaffs2_fanout);
+	for (i = 0; i < mkyaffs2_ntargets; i++)
+		mtd_dev_close(&mkyaffs2_targets[i].dev);
 	if (mkyaffs2_image_fd >= 0)
 		close(mkyaffs2_image_fd);
-	free(mkyaffs2_databuf);
+	if (mkyaffs2_spare_fd >= 0)
+		close(mkyaffs2_spare_fd);
+	thread_pool_destroy(mkyaffs2_pool);
+	free(mkyaffs2_padding);
+	free(mkyaffs2_summary);
+	free(mkyaffs2_sparebuf);
+	free(mkyaffs2_splitbuf);
+	free(mkyaffs2_backphys);
+	free(mkyaffs2_backbuf);
+	free(mkyaffs2_physbuf);
+	free(mkyaffs2_batchbuf);
 exit_and_out:
 	mkyaffs2_objtree_exit(&mkyaffs2_objtree);
 	mkyaffs2_objtable_exit();
@@ -928,6 +2086,70 @@ exit_and_out:
 
 /*----------------------------------------------------------------------------*/
 
+/*
+ * Open the devices to be programmed, all with the same image. Their pages
+ * must be those of the image, and they have the pages per block of the
+ * image; a file emulating one takes the geometry of the options, unless
+ * its own options tell otherwise.
+ */
+static int
+mkyaffs2_open_targets (char **paths, unsigned n)
+{
+	unsigned i;
+	struct mtd_dev *dev;
+
+	mkyaffs2_targets = calloc(n, sizeof(struct mtd_target));
+	if (mkyaffs2_targets == NULL) {
+		MKYAFFS2_ERROR("cannot allocate %u devices: %s\n", n,
+				strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		dev = &mkyaffs2_targets[i].dev;
+		mkyaffs2_targets[i].path = paths[i];
+
+		if (mtd_dev_open(dev, paths[i], mkyaffs2_pagesize,
+				 MKYAFFS2_ISINBAND ? mkyaffs2_pagesize / 32 :
+						     mkyaffs2_sparesize,
+				 mkyaffs2_pages_per_block) < 0) {
+			MKYAFFS2_ERROR("cannot open the mtd device '%s' "
+				       "(a file needs '--pages-per-block' "
+				       "or 'ppb=', and whole blocks): %s\n",
+				       paths[i], strerror(errno));
+			goto close_and_out;
+		}
+		mkyaffs2_ntargets++;
+
+		if (dev->writesize != mkyaffs2_pagesize ||
+		    (!MKYAFFS2_ISINBAND && dev->oobsize < mkyaffs2_sparesize) ||
+		    (mkyaffs2_pages_per_block &&
+		     mkyaffs2_pages_per_block != dev->pages_per_block)) {
+			MKYAFFS2_ERROR("mtd device '%s' of %u + %u bytes "
+				       "pages and %u pages per block does "
+				       "NOT match.\n", paths[i],
+				       dev->writesize, dev->oobsize,
+				       dev->pages_per_block);
+			goto close_and_out;
+		}
+
+		mkyaffs2_pages_per_block = dev->pages_per_block;
+	}
+
+	return 0;
+
+close_and_out:
+	for (i = 0; i < mkyaffs2_ntargets; i++)
+		mtd_dev_close(&mkyaffs2_targets[i].dev);
+	free(mkyaffs2_targets);
+	mkyaffs2_targets = NULL;
+	mkyaffs2_ntargets = 0;
+
+	return -1;
+}
+
+/*----------------------------------------------------------------------------*/
+
 static int
 mkyaffs2_helper (void)
 {
@@ -935,7 +2157,20 @@ mkyaffs2_helper (void)
 	MKYAFFS2_HELP("Usage: mkyaffs2 [-h|--help] [-e|--endian] [-v|--verbose]\n"
 		      "                [-p|--pagesize pagesize] [-s|sparesize sparesize]\n"
 		      "                [-o|--oobimg oobimage] [--all-root] [--yaffs-ecclayout]\n"
-		      "                dirname imgfile\n\n");
+		      "                [--ecc hamming|bch] [--ecc-strength bits]\n"
+		      "                [--ecc-step bytes] [-j|--jobs threads]\n"
+		      "                [--pages-per-block pages] [--partition-size bytes]\n"
+		      "                [--checkpoint] [--checkpoint-ptr-size 32|64]\n"
+		      "                [--summary] [--inband-tags]\n"
+		      "                [--skip-zero] [--dedup] [--layout packed|aligned]\n"
+		      "                [--align-size bytes] [--sparse]\n"
+		      "                [--compress gzip|zstd] [--compress-level level]\n"
+		      "                [--split-spare sparefile] [--syndrome]\n"
+		      "                [--syndrome-pad prepad,postpad]\n"
+		      "                [--scramble seed] [--scramble-period pages]\n"
+		      "                [--page-map mapfile] [--mtd]\n"
+		      "                [--mtd-queue bytes]\n"
+		      "                dirname imgfile|-|device...\n\n");
 	MKYAFFS2_HELP("Options:\n");
 	MKYAFFS2_HELP("  -h                 display this help message and exit.\n");
 	MKYAFFS2_HELP("  -e                 convert endian differed from local machine.\n");
@@ -947,6 +2182,40 @@ mkyaffs2_helper (void)
 	MKYAFFS2_HELP("  -o oobimage        load external oob image file.\n");
 	MKYAFFS2_HELP("  --all-root         all files in the target system are owned by root.\n");
 	MKYAFFS2_HELP("  --yaffs-ecclayout  use yaffs oob scheme instead of the Linux MTD default.\n");
+	MKYAFFS2_HELP("  --ecc hamming|bch  compute the Linux MTD software ecc of data into eccpos.\n");
+	MKYAFFS2_HELP("  --ecc-strength     bch: bit errors corrected per step (default: %u).\n",
+		      NAND_ECC_BCH_STRENGTH);
+	MKYAFFS2_HELP("  --ecc-step         bch: data bytes per ecc step (default: %u).\n",
+		      NAND_ECC_BCH_STEP);
+	MKYAFFS2_HELP("  -j threads         worker threads for the ecc (default: online cpus).\n");
+	MKYAFFS2_HELP("  --pages-per-block  pages per erase block, for block sequence numbers.\n");
+	MKYAFFS2_HELP("  --partition-size   pad the image with erased pages up to the partition.\n");
+	MKYAFFS2_HELP("  --checkpoint       write a checkpoint, so the first mount needs no scan.\n");
+	MKYAFFS2_HELP("  --checkpoint-ptr-size\n"
+		      "                     pointer bits of the target kernel (default: 32).\n");
+	MKYAFFS2_HELP("  --summary          end every full block with the summary of its tags.\n");
+	MKYAFFS2_HELP("  --inband-tags      tags at the tail of every page, no oob in the image.\n");
+	MKYAFFS2_HELP("  --skip-zero        leave out the chunks of zeros, as the holes of files.\n");
+	MKYAFFS2_HELP("  --dedup            files of the same content become hardlinks.\n");
+	MKYAFFS2_HELP("  --layout           aligned: large files from a block boundary, and the\n"
+		      "                     small files of a directory in shared blocks.\n");
+	MKYAFFS2_HELP("  --align-size       smallest file aligned (default: a block of data).\n");
+	MKYAFFS2_HELP("  --sparse           write an Android sparse image, erased pages filled.\n");
+	MKYAFFS2_HELP("  --compress         compress the image, in frames over the threads.\n");
+	MKYAFFS2_HELP("  --compress-level   gzip: 1-9 (default: 6); zstd: 1-19 (default: 3).\n");
+	MKYAFFS2_HELP("  --split-spare      the data areas to imgfile, the spares to sparefile.\n");
+	MKYAFFS2_HELP("  --syndrome         the ecc of every step right after its data.\n");
+	MKYAFFS2_HELP("  --syndrome-pad     spare bytes before and after every ecc (default: 0,0).\n");
+	MKYAFFS2_HELP("  --scramble         randomize the data of every page from the prbs15 seed.\n");
+	MKYAFFS2_HELP("  --scramble-period  pages before the keystreams repeat\n"
+		      "                     (default: pages-per-block, or %u).\n",
+		      SCRAMBLER_PERIOD);
+	MKYAFFS2_HELP("  --page-map         write the bitmap of the pages not erased to mapfile.\n");
+	MKYAFFS2_HELP("  --mtd              program the mtd devices (or files emulating them)\n"
+		      "                     instead of imgfile, skipping bad blocks.\n");
+	MKYAFFS2_HELP("  --mtd-queue        bytes of pages a device may fall behind the\n"
+		      "                     fastest one (default: %u MiB).\n",
+		      MTD_FANOUT_QUEUE >> 20);
 
 	return -1;
 }
@@ -960,7 +2229,7 @@ main (int argc, char *argv[])
 	char *dirpath = NULL, *imgfile = NULL, *oobfile = NULL;
 	
 	int option, option_index;
-	static const char *short_options = "hvep:s:o:";
+	static const char *short_options = "hvep:s:o:j:";
 	static const struct option long_options[] = {
 		{"pagesize", 		required_argument, 	0, 'p'},
 		{"sparesize", 		required_argument, 	0, 's'},
@@ -969,11 +2238,42 @@ main (int argc, char *argv[])
 		{"verbose", 		no_argument, 		0, 'v'},
 		{"all-root",		no_argument,		0, '0'},
 		{"yaffs-ecclayout",	no_argument,		0, 'y'},
+		{"ecc",			required_argument,	0, 'E'},
+		{"ecc-strength",	required_argument,	0, 'T'},
+		{"ecc-step",		required_argument,	0, 'P'},
+		{"jobs",		required_argument,	0, 'j'},
+		{"pages-per-block",	required_argument,	0, 'B'},
+		{"partition-size",	required_argument,	0, 'Z'},
+		{"checkpoint",		no_argument,		0, 'K'},
+		{"checkpoint-ptr-size",	required_argument,	0, 'G'},
+		{"summary",		no_argument,		0, 'S'},
+		{"inband-tags",		no_argument,		0, 'I'},
+		{"skip-zero",		no_argument,		0, 'z'},
+		{"dedup",		no_argument,		0, 'D'},
+		{"layout",		required_argument,	0, 'L'},
+		{"align-size",		required_argument,	0, 'A'},
+		{"sparse",		no_argument,		0, 'X'},
+		{"compress",		required_argument,	0, 'C'},
+		{"compress-level",	required_argument,	0, 'l'},
+		{"split-spare",		required_argument,	0, 'O'},
+		{"syndrome",		no_argument,		0, 'Y'},
+		{"syndrome-pad",	required_argument,	0, 'V'},
+		{"scramble",		required_argument,	0, 'R'},
+		{"scramble-period",	required_argument,	0, 'Q'},
+		{"page-map",		required_argument,	0, 'M'},
+		{"mtd",			no_argument,		0, 'W'},
+		{"mtd-queue",		required_argument,	0, 'U'},
 		{"help", 		no_argument, 		0, 'h'},
 		{NULL,			no_argument,		0, '\0'},
 	};
 
+	unsigned i, oobavail;
+	unsigned ecc_mode = NAND_ECC_NONE;
+	unsigned ecc_step = 0, ecc_strength = 0;
+	unsigned prepad = 0, postpad = 0;
+
 	mkyaffs2_chunksize = DEFAULT_CHUNKSIZE;
+	mkyaffs2_threads = thread_pool_cpus();
 
 	while ((option = getopt_long(argc, argv, short_options,
 				     long_options, &option_index)) != EOF) {
@@ -999,6 +2299,104 @@ main (int argc, char *argv[])
 		case '0':
 			mkyaffs2_flags |= MKYAFFS2_FLAGS_ALLROOT;
 			break;
+		case 'E':
+			if (!strcmp(optarg, "hamming"))
+				ecc_mode = NAND_ECC_HAMMING;
+			else if (!strcmp(optarg, "bch"))
+				ecc_mode = NAND_ECC_BCH;
+			else if (!strcmp(optarg, "none"))
+				ecc_mode = NAND_ECC_NONE;
+			else
+				return mkyaffs2_helper();
+			break;
+		case 'T':
+			ecc_strength = strtoul(optarg, NULL, 10);
+			break;
+		case 'P':
+			ecc_step = strtoul(optarg, NULL, 10);
+			break;
+		case 'j':
+			mkyaffs2_threads = strtoul(optarg, NULL, 10);
+			break;
+		case 'B':
+			mkyaffs2_pages_per_block = strtoul(optarg, NULL, 10);
+			break;
+		case 'Z':
+			mkyaffs2_partition_size = strtoull(optarg, NULL, 0);
+			break;
+		case 'K':
+			mkyaffs2_flags |= MKYAFFS2_FLAGS_CHECKPT;
+			break;
+		case 'G':
+			mkyaffs2_checkpt_ptr = strtoul(optarg, NULL, 10);
+			break;
+		case 'S':
+			mkyaffs2_flags |= MKYAFFS2_FLAGS_SUMMARY;
+			break;
+		case 'I':
+			mkyaffs2_flags |= MKYAFFS2_FLAGS_INBAND;
+			break;
+		case 'z':
+			mkyaffs2_flags |= MKYAFFS2_FLAGS_SKIPZERO;
+			break;
+		case 'D':
+			mkyaffs2_flags |= MKYAFFS2_FLAGS_DEDUP;
+			break;
+		case 'L':
+			if (!strcmp(optarg, "aligned"))
+				mkyaffs2_flags |= MKYAFFS2_FLAGS_ALIGNED;
+			else if (!strcmp(optarg, "packed"))
+				mkyaffs2_flags &= ~MKYAFFS2_FLAGS_ALIGNED;
+			else
+				return mkyaffs2_helper();
+			break;
+		case 'A':
+			mkyaffs2_align_size = strtoull(optarg, NULL, 0);
+			break;
+		case 'X':
+			mkyaffs2_flags |= MKYAFFS2_FLAGS_SPARSE;
+			break;
+		case 'C':
+			if (!strcmp(optarg, "none")) {
+				mkyaffs2_compress_mode = COMPRESS_NONE;
+				break;
+			}
+			if (compress_mode(optarg) < 0) {
+				MKYAFFS2_ERROR("'%s' compression is NOT "
+					       "supported.\n", optarg);
+				return -1;
+			}
+			mkyaffs2_compress_mode = compress_mode(optarg);
+			break;
+		case 'l':
+			mkyaffs2_compress_level = strtol(optarg, NULL, 10);
+			break;
+		case 'O':
+			mkyaffs2_sparefile = optarg;
+			break;
+		case 'Y':
+			mkyaffs2_flags |= MKYAFFS2_FLAGS_SYNDROME;
+			break;
+		case 'V':
+			if (sscanf(optarg, "%u,%u", &prepad, &postpad) != 2)
+				return mkyaffs2_helper();
+			break;
+		case 'R':
+			mkyaffs2_flags |= MKYAFFS2_FLAGS_SCRAMBLE;
+			mkyaffs2_scramble_seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'Q':
+			mkyaffs2_scramble_period = strtoul(optarg, NULL, 10);
+			break;
+		case 'M':
+			mkyaffs2_mapfile = optarg;
+			break;
+		case 'W':
+			mkyaffs2_flags |= MKYAFFS2_FLAGS_MTD;
+			break;
+		case 'U':
+			mkyaffs2_mtd_queue = strtoull(optarg, NULL, 0);
+			break;
 		case 'h':
 		default:
 			return mkyaffs2_helper();
@@ -1011,6 +2409,17 @@ main (int argc, char *argv[])
 	dirpath = argv[optind];
 	imgfile = argv[optind + 1];
 
+	/* '-': the image goes to stdout, and all the messages to stderr */
+	if (!strcmp(imgfile, "-")) {
+		mkyaffs2_image_fd = dup(STDOUT_FILENO);
+		if (mkyaffs2_image_fd < 0 ||
+		    dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+			MKYAFFS2_ERROR("cannot write the image to stdout: "
+				       "%s\n", strerror(errno));
+			return -1;
+		}
+	}
+
 	MKYAFFS2_PRINTF("mkyaffs2 %s: image building tool for YAFFS2.\n",
 			YAFFS2UTILS_VERSION);
 
@@ -1059,6 +2468,24 @@ main (int argc, char *argv[])
 		return -1;
 	}
 
+	mkyaffs2_pagesize = mkyaffs2_chunksize;
+
+	/*
+	 * inband tags: the tags take the tail of the page and the oob is
+	 * left to the MTD, as the kernel does with 'inband_tags'.
+	 */
+	if (MKYAFFS2_ISINBAND) {
+		if (MKYAFFS2_ISYAFFS1 || oobfile || mkyaffs2_sparesize ||
+		    ecc_mode != NAND_ECC_NONE) {
+			MKYAFFS2_ERROR("inband tags need a yaffs2 image "
+				       "without oob or ecc options.\n");
+			return -1;
+		}
+		mkyaffs2_sparesize = sizeof(struct yaffs_packed_tags2_tags_only);
+		mkyaffs2_chunksize -= mkyaffs2_sparesize;
+		mkyaffs2_assemble_ptags = &mkyaffs2_assemble_ptags_inband;
+	}
+
 	/* spare size */
 	if (!mkyaffs2_sparesize)
 		mkyaffs2_sparesize = mkyaffs2_chunksize / 32;
@@ -1069,6 +2496,136 @@ main (int argc, char *argv[])
 		return -1;
 	}
 
+	/* software ecc of the data area */
+	if (nand_ecc_setup(&mkyaffs2_ecc, ecc_mode, ecc_step, ecc_strength,
+			   mkyaffs2_chunksize, mkyaffs2_sparesize,
+			   mkyaffs2_ecclayout) < 0) {
+		MKYAFFS2_ERROR("ecc does NOT fit in the %u bytes spare.\n",
+				mkyaffs2_sparesize);
+		return -1;
+	}
+
+	/* the tags go where the ecc left room, in a copy of the layout */
+	mkyaffs2_ecclayout = &mkyaffs2_ecc.layout;
+
+	/* ecc after every step of data, the tags in the rest of the oob */
+	if (MKYAFFS2_ISSYNDROME) {
+		if (ecc_mode == NAND_ECC_NONE ||
+		    nand_ecc_syndrome(&mkyaffs2_ecc, prepad, postpad,
+				      mkyaffs2_sparesize,
+				      &mkyaffs2_syndrome_layout) < 0) {
+			MKYAFFS2_ERROR("syndrome layout needs '--ecc', "
+				       "fitting with its pads in the "
+				       "%u bytes spare.\n",
+				       mkyaffs2_sparesize);
+			nand_ecc_release(&mkyaffs2_ecc);
+			return -1;
+		}
+		mkyaffs2_ecclayout = &mkyaffs2_syndrome_layout;
+	}
+
+	for (i = 0, oobavail = 0; i < MTD_MAX_OOBFREE_ENTRIES; i++)
+		oobavail += mkyaffs2_ecclayout->oobfree[i].length;
+
+	if (!MKYAFFS2_ISINBAND && oobavail < (MKYAFFS2_ISYAFFS1 ?
+			sizeof(struct yaffs_packed_tags1) -
+			sizeof(((struct yaffs_packed_tags1 *)0)->should_be_ff) :
+			sizeof(struct yaffs_packed_tags2))) {
+		MKYAFFS2_ERROR("no room left for the tags in the oob (%u bytes).\n",
+				oobavail);
+		nand_ecc_release(&mkyaffs2_ecc);
+		return -1;
+	}
+
+	/* the geometry of the devices makes that of the image */
+	if (MKYAFFS2_ISMTD) {
+		if (mkyaffs2_image_fd >= 0 || MKYAFFS2_ISSPARSE ||
+		    mkyaffs2_sparefile ||
+		    mkyaffs2_compress_mode != COMPRESS_NONE) {
+			MKYAFFS2_ERROR("mtd device needs neither stdout, "
+				       "sparse, split nor compressed "
+				       "output.\n");
+			nand_ecc_release(&mkyaffs2_ecc);
+			return -1;
+		}
+
+		if (mkyaffs2_open_targets(argv + optind + 1,
+					  argc - optind - 1) < 0) {
+			nand_ecc_release(&mkyaffs2_ecc);
+			return -1;
+		}
+	}
+
+	/* partition geometry */
+	if (mkyaffs2_partition_size % ((unsigned long long)mkyaffs2_pagesize *
+	    (mkyaffs2_pages_per_block ? mkyaffs2_pages_per_block : 1))) {
+		MKYAFFS2_ERROR("partition size is NOT a multiple of the %s.\n",
+				mkyaffs2_pages_per_block ? "block" : "page");
+		nand_ecc_release(&mkyaffs2_ecc);
+		return -1;
+	}
+
+	/* the checkpoint describes every block of the partition */
+	if (MKYAFFS2_ISCHECKPT && (MKYAFFS2_ISYAFFS1 ||
+	    !mkyaffs2_pages_per_block || !mkyaffs2_partition_size)) {
+		MKYAFFS2_ERROR("checkpoint needs a yaffs2 image, "
+			       "'--pages-per-block' and '--partition-size'.\n");
+		nand_ecc_release(&mkyaffs2_ecc);
+		return -1;
+	}
+
+	if (mkyaffs2_checkpt_ptr != 32 && mkyaffs2_checkpt_ptr != 64) {
+		MKYAFFS2_ERROR("checkpoint pointer size must be 32 or 64.\n");
+		nand_ecc_release(&mkyaffs2_ecc);
+		return -1;
+	}
+
+	if (MKYAFFS2_ISALIGNED && !mkyaffs2_pages_per_block) {
+		MKYAFFS2_ERROR("aligned layout needs '--pages-per-block'.\n");
+		nand_ecc_release(&mkyaffs2_ecc);
+		return -1;
+	}
+
+	/* a block of data at least, by default */
+	if (!mkyaffs2_align_size) {
+		mkyaffs2_align_size = (unsigned long long)mkyaffs2_chunksize *
+				      mkyaffs2_pages_per_block;
+	}
+
+	if (MKYAFFS2_ISSUMMARY) {
+		if (!MKYAFFS2_ISYAFFS1 && mkyaffs2_pages_per_block)
+			mkyaffs2_summary_chunks = summary_chunks(
+				mkyaffs2_chunksize, mkyaffs2_pages_per_block);
+
+		if (mkyaffs2_summary_chunks == 0) {
+			MKYAFFS2_ERROR("summary needs a yaffs2 image and "
+				       "'--pages-per-block'.\n");
+			nand_ecc_release(&mkyaffs2_ecc);
+			return -1;
+		}
+	}
+
+	/* the sparse header is rewritten at the end, the stream is not */
+	if (MKYAFFS2_ISSPARSE && mkyaffs2_compress_mode != COMPRESS_NONE) {
+		MKYAFFS2_ERROR("sparse image cannot be compressed.\n");
+		nand_ecc_release(&mkyaffs2_ecc);
+		return -1;
+	}
+
+	/* the spares go to a file of their own, next to a plain data file */
+	if (mkyaffs2_sparefile && (MKYAFFS2_ISINBAND || MKYAFFS2_ISSPARSE ||
+	    mkyaffs2_compress_mode != COMPRESS_NONE)) {
+		MKYAFFS2_ERROR("split spare needs an oob, and neither "
+			       "sparse nor compressed output.\n");
+		nand_ecc_release(&mkyaffs2_ecc);
+		return -1;
+	}
+
+	if (mkyaffs2_compress_level < 0) {
+		mkyaffs2_compress_level =
+			compress_default_level(mkyaffs2_compress_mode);
+	}
+
 	/* verify whether the input directory is valid */
 	if (strlen(dirpath) >= PATH_MAX || strlen(imgfile) >= PATH_MAX) {
 		MKYAFFS2_ERROR("directory or image path is too long ");
@@ -1077,16 +2634,108 @@ main (int argc, char *argv[])
 	}
 
 
+	/* the keystreams restart with every block, as the controllers do */
+	if (!mkyaffs2_scramble_period) {
+		mkyaffs2_scramble_period = mkyaffs2_pages_per_block ?
+					   mkyaffs2_pages_per_block :
+					   SCRAMBLER_PERIOD;
+	}
+
+	if (MKYAFFS2_ISSCRAMBLE &&
+	    scrambler_init(&mkyaffs2_scrambler, mkyaffs2_scramble_seed,
+			   mkyaffs2_chunksize, mkyaffs2_scramble_period) < 0) {
+		MKYAFFS2_ERROR("cannot set up the randomizer.\n");
+		nand_ecc_release(&mkyaffs2_ecc);
+		return -1;
+	}
+
 	retval = mkyaffs2_create_image(dirpath, imgfile);
+	scrambler_release(&mkyaffs2_scrambler);
+	nand_ecc_release(&mkyaffs2_ecc);
 	if (!retval) {
 		MKYAFFS2_PRINTF("\noperation complete,\n"
 				"%u objects in %u NAND pages.\n",
 				mkyaffs2_image_objs, mkyaffs2_image_pages);
+		if (mkyaffs2_image_blocks) {
+			MKYAFFS2_PRINTF("%u erase blocks of %u pages "
+					"(sequence %u to %u).\n",
+					mkyaffs2_image_blocks,
+					mkyaffs2_pages_per_block,
+					YAFFS_LOWEST_SEQUENCE_NUMBER + 1,
+					YAFFS_LOWEST_SEQUENCE_NUMBER +
+					(mkyaffs2_image_pages +
+					 mkyaffs2_pages_per_block - 1) /
+					mkyaffs2_pages_per_block);
+		}
+		if (mkyaffs2_pad_pages) {
+			MKYAFFS2_PRINTF("aligned layout: %u erased pages of "
+					"padding (%.1f%% overhead).\n",
+					mkyaffs2_pad_pages,
+					100.0 * mkyaffs2_pad_pages /
+					(mkyaffs2_image_pages -
+					 mkyaffs2_pad_pages));
+		}
+		if (mkyaffs2_dedup_objs) {
+			MKYAFFS2_PRINTF("%u duplicated files made hardlinks, "
+					"%llu image bytes saved.\n",
+					mkyaffs2_dedup_objs,
+					mkyaffs2_dedup_bytes);
+		}
+		if (mkyaffs2_hole_chunks) {
+			MKYAFFS2_PRINTF("%u chunks of holes left out.\n",
+					mkyaffs2_hole_chunks);
+		}
+		if (mkyaffs2_checkpt_blocks) {
+			MKYAFFS2_PRINTF("checkpoint in %u erase blocks, "
+					"for a %u-bit kernel.\n",
+					mkyaffs2_checkpt_blocks,
+					mkyaffs2_checkpt_ptr);
+		}
+		if (MKYAFFS2_ISSPARSE) {
+			MKYAFFS2_PRINTF("sparse image: %u chunks, %u of %u "
+					"pages filled.\n",
+					mkyaffs2_sparse.total_chunks,
+					mkyaffs2_sparse.fill_total,
+					mkyaffs2_sparse.total_blks);
+		}
+		if (mkyaffs2_compress_mode != COMPRESS_NONE) {
+			MKYAFFS2_PRINTF("compressed image: %llu bytes "
+					"into %llu (%.1f%%).\n",
+					mkyaffs2_compress.in_total,
+					mkyaffs2_compress.out_total,
+					100.0 * mkyaffs2_compress.out_total /
+					mkyaffs2_compress.in_total);
+		}
+		if (mkyaffs2_mapfile) {
+			MKYAFFS2_PRINTF("page map: %u of %u pages "
+					"programmed.\n",
+					mkyaffs2_pagemap.programmed,
+					mkyaffs2_pagemap.pages);
+		}
 	}
 	else {
 		MKYAFFS2_ERROR("\noperation incomplete,\n"
 			       "image may be broken!!!\n");
 	}
 
+	/* every device on its own, whether the others made it or not */
+	for (i = 0; i < mkyaffs2_ntargets; i++) {
+		struct mtd_target *t = &mkyaffs2_targets[i];
+
+		if (t->error) {
+			MKYAFFS2_ERROR("'%s': FAILED after %u blocks: %s\n",
+				       t->path, t->prog.programmed,
+				       strerror(t->error));
+			continue;
+		}
+		MKYAFFS2_PRINTF("'%s': %u blocks programmed, %u bad blocks "
+				"skipped, %u gone bad.\n", t->path,
+				t->prog.programmed, t->prog.bad,
+				t->prog.failed);
+	}
+	free(mkyaffs2_targets);
+
+	page_map_release(&mkyaffs2_pagemap);
+
 	return retval;
 }
@@ -0,0 +1,309 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "configs.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifndef _HAVE_BROKEN_MTD_H
+#include <mtd/mtd-user.h>
+#endif
+
+#include "mtd_dev.h"
+
+/*----------------------------------------------------------------------------*/
+
+static int
+mtd_dev_open_emu (struct mtd_dev *dev, const char *path, unsigned writesize,
+		  unsigned oobsize, unsigned pages_per_block)
+{
+	dev->emu = malloc(sizeof(struct nand_emu));
+	if (dev->emu == NULL)
+		return -1;
+
+	if (nand_emu_open(dev->emu, path, writesize, oobsize,
+			  pages_per_block) < 0) {
+		free(dev->emu);
+		dev->emu = NULL;
+		return -1;
+	}
+
+	dev->writesize = dev->emu->writesize;
+	dev->oobsize = dev->emu->oobsize;
+	dev->pages_per_block = dev->emu->pages_per_block;
+	dev->erasesize = dev->writesize * dev->pages_per_block;
+	dev->blocks = dev->emu->blocks;
+
+	return 0;
+}
+
+#ifndef _HAVE_BROKEN_MTD_H
+static int
+mtd_dev_open_mtd (struct mtd_dev *dev, const char *path)
+{
+	struct mtd_info_user info;
+
+	dev->fd = open(path, O_RDWR);
+	if (dev->fd < 0)
+		return -1;
+
+	if (ioctl(dev->fd, MEMGETINFO, &info) < 0)
+		return -1;
+
+	if (info.type != MTD_NANDFLASH && info.type != MTD_MLCNANDFLASH) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	dev->writesize = info.writesize;
+	dev->oobsize = info.oobsize;
+	dev->erasesize = info.erasesize;
+	dev->pages_per_block = info.erasesize / info.writesize;
+	dev->blocks = info.size / info.erasesize;
+
+	return 0;
+}
+#endif
+
+int
+mtd_dev_open (struct mtd_dev *dev, const char *path, unsigned writesize,
+	      unsigned oobsize, unsigned pages_per_block)
+{
+	struct stat statbuf;
+	int retval;
+
+	memset(dev, 0, sizeof(*dev));
+	dev->fd = -1;
+
+	if (stat(path, &statbuf) < 0 || !S_ISCHR(statbuf.st_mode))
+		return mtd_dev_open_emu(dev, path, writesize, oobsize,
+					pages_per_block);
+
+#ifndef _HAVE_BROKEN_MTD_H
+	retval = mtd_dev_open_mtd(dev, path);
+#else
+	errno = ENODEV;
+	retval = -1;
+#endif
+	if (retval < 0)
+		mtd_dev_close(dev);
+
+	return retval;
+}
+
+void
+mtd_dev_close (struct mtd_dev *dev)
+{
+	int err = errno;
+
+	if (dev->fd >= 0)
+		close(dev->fd);
+
+	if (dev->emu != NULL) {
+		nand_emu_close(dev->emu);
+		free(dev->emu);
+	}
+
+	dev->emu = NULL;
+	dev->fd = -1;
+	errno = err;
+}
+
+/*----------------------------------------------------------------------------*/
+
+int
+mtd_dev_isbad (const struct mtd_dev *dev, unsigned block)
+{
+	if (block >= dev->blocks) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (dev->emu != NULL)
+		return nand_emu_isbad(dev->emu, block);
+
+#ifndef _HAVE_BROKEN_MTD_H
+	{
+		loff_t offset = (loff_t)block * dev->erasesize;
+
+		return ioctl(dev->fd, MEMGETBADBLOCK, &offset);
+	}
+#else
+	return -1;
+#endif
+}
+
+int
+mtd_dev_markbad (const struct mtd_dev *dev, unsigned block)
+{
+	if (dev->emu != NULL)
+		return nand_emu_markbad(dev->emu, block);
+
+#ifndef _HAVE_BROKEN_MTD_H
+	{
+		loff_t offset = (loff_t)block * dev->erasesize;
+
+		return ioctl(dev->fd, MEMSETBADBLOCK, &offset);
+	}
+#else
+	return -1;
+#endif
+}
+
+int
+mtd_dev_erase (const struct mtd_dev *dev, unsigned block)
+{
+	if (dev->emu != NULL)
+		return nand_emu_erase(dev->emu, block);
+
+#ifndef _HAVE_BROKEN_MTD_H
+	{
+		struct erase_info_user64 ei;
+
+		ei.start = (uint64_t)block * dev->erasesize;
+		ei.length = dev->erasesize;
+
+		return ioctl(dev->fd, MEMERASE64, &ei);
+	}
+#else
+	return -1;
+#endif
+}
+
+int
+mtd_dev_write (const struct mtd_dev *dev, unsigned block,
+	       const unsigned char *data, const unsigned char *oob,
+	       unsigned pages, int raw)
+{
+	if (pages > dev->pages_per_block) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (dev->emu != NULL)
+		return nand_emu_write(dev->emu, block, data, oob, pages);
+
+#ifndef _HAVE_BROKEN_MTD_H
+	{
+		/* the whole run in one request, the oob of every page too */
+		struct mtd_write_req req;
+
+		memset(&req, 0, sizeof(req));
+		req.start = (uint64_t)block * dev->erasesize;
+		req.len = (uint64_t)pages * dev->writesize;
+		req.ooblen = (uint64_t)pages * dev->oobsize;
+		req.usr_data = (uintptr_t)data;
+		req.usr_oob = (uintptr_t)oob;
+		req.mode = raw ? MTD_OPS_RAW : MTD_OPS_PLACE_OOB;
+
+		return ioctl(dev->fd, MEMWRITE, &req);
+	}
+#else
+	return -1;
+#endif
+}
+
+#if !defined(_HAVE_BROKEN_MTD_H) && !defined(MEMREAD)
+/* before MEMREAD: the data with the ecc, the oob a page at a time */
+static int
+mtd_dev_read_oob (const struct mtd_dev *dev, unsigned block,
+		  unsigned char *data, unsigned char *oob, unsigned pages)
+{
+	struct mtd_oob_buf ob;
+	off_t offset = (off_t)block * dev->erasesize;
+	size_t size = (size_t)pages * dev->writesize;
+	unsigned i;
+
+	if (pread(dev->fd, data, size, offset) != size)
+		return -1;
+
+	for (i = 0; oob != NULL && i < pages; i++) {
+		ob.start = offset + (off_t)i * dev->writesize;
+		ob.length = dev->oobsize;
+		ob.ptr = oob + (size_t)i * dev->oobsize;
+		if (ioctl(dev->fd, MEMREADOOB, &ob) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+#endif
+
+int
+mtd_dev_read (const struct mtd_dev *dev, unsigned block,
+	      unsigned char *data, unsigned char *oob,
+	      unsigned pages, int raw)
+{
+	if (block >= dev->blocks || pages > dev->pages_per_block) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (dev->emu != NULL)
+		return nand_emu_read(dev->emu, block, data, oob, pages, raw);
+
+#if !defined(_HAVE_BROKEN_MTD_H) && defined(MEMREAD)
+	{
+		struct mtd_read_req req;
+
+		memset(&req, 0, sizeof(req));
+		req.start = (uint64_t)block * dev->erasesize;
+		req.len = (uint64_t)pages * dev->writesize;
+		req.ooblen = oob != NULL ? (uint64_t)pages * dev->oobsize : 0;
+		req.usr_data = (uintptr_t)data;
+		req.usr_oob = (uintptr_t)oob;
+		req.mode = raw ? MTD_OPS_RAW : MTD_OPS_PLACE_OOB;
+
+		/* the data comes with EUCLEAN and EBADMSG as well */
+		if (ioctl(dev->fd, MEMREAD, &req) < 0 && errno != EUCLEAN)
+			return -1;
+
+		if (req.ecc_stats.uncorrectable_errors) {
+			errno = EBADMSG;
+			return -1;
+		}
+
+		return req.ecc_stats.corrected_bitflips;
+	}
+#elif !defined(_HAVE_BROKEN_MTD_H)
+	return mtd_dev_read_oob(dev, block, data, oob, pages);
+#else
+	return -1;
+#endif
+}
+
+int
+mtd_dev_ecclayout (const struct mtd_dev *dev, nand_ecclayout_t *layout)
+{
+	if (dev->emu != NULL)
+		return nand_emu_ecclayout(dev->emu, layout);
+
+	/* FIXME: ECCGETLAYOUT is deprecated in the latest kernel. */
+	memset(layout, 0, sizeof(nand_ecclayout_t));
+#ifndef _HAVE_BROKEN_MTD_H
+	return ioctl(dev->fd, ECCGETLAYOUT, layout);
+#else
+	return -1;
+#endif
+}
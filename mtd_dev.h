@@ -0,0 +1,74 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_MTD_DEV_H__
+#define __YAFFS2UTILS_MTD_DEV_H__
+
+#include "nand_emu.h"
+
+/*
+ * A NAND MTD character device, or a file emulating one (see nand_emu.h):
+ * any path which is not a character device, with the options of the
+ * emulation after it.
+ */
+typedef struct mtd_dev {
+	int fd;
+	struct nand_emu *emu;		/* the file emulating the device */
+	unsigned writesize;
+	unsigned oobsize;
+	unsigned erasesize;
+	unsigned pages_per_block;
+	unsigned blocks;
+} mtd_dev_t;
+
+/*
+ * The geometry of a device is its own; a file takes 'writesize', 'oobsize'
+ * and 'pages_per_block' unless its options tell otherwise, and its size is
+ * a number of such blocks.
+ */
+int mtd_dev_open (struct mtd_dev *dev, const char *path, unsigned writesize,
+		  unsigned oobsize, unsigned pages_per_block);
+void mtd_dev_close (struct mtd_dev *dev);
+
+/* 1 if the block is bad, 0 if good, -1 if it cannot be told */
+int mtd_dev_isbad (const struct mtd_dev *dev, unsigned block);
+int mtd_dev_markbad (const struct mtd_dev *dev, unsigned block);
+int mtd_dev_erase (const struct mtd_dev *dev, unsigned block);
+
+/*
+ * Program 'pages' pages from the start of an erased block, their data and
+ * oob laid out one page after another. 'raw' leaves out the ecc of the
+ * driver, for pages which carry their own.
+ */
+int mtd_dev_write (const struct mtd_dev *dev, unsigned block,
+		   const unsigned char *data, const unsigned char *oob,
+		   unsigned pages, int raw);
+
+/*
+ * Read them back, the oob too unless it is NULL. Returns the bit flips
+ * the ecc of the driver corrected, or -1; EBADMSG tells a page beyond
+ * repair, and the data is read all the same.
+ */
+int mtd_dev_read (const struct mtd_dev *dev, unsigned block,
+		  unsigned char *data, unsigned char *oob,
+		  unsigned pages, int raw);
+
+/* the oob layout of the ecc of the driver */
+int mtd_dev_ecclayout (const struct mtd_dev *dev, nand_ecclayout_t *layout);
+
+#endif
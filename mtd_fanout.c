@@ -0,0 +1,262 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mtd_fanout.h"
+
+/*----------------------------------------------------------------------------*/
+
+/* with the lock held */
+static void
+mtd_fanout_put (struct mtd_fanout *fo, struct mtd_batch *b)
+{
+	if (--b->refs)
+		return;
+
+	b->next = fo->free;
+	fo->free = b;
+}
+
+static void *
+mtd_fanout_worker (void *data)
+{
+	struct mtd_target *t = data;
+	struct mtd_fanout *fo = t->fanout;
+	struct mtd_batch *b;
+	const unsigned char *buf;
+
+	pthread_mutex_lock(&fo->lock);
+	for (;;) {
+		while (t->next == NULL && !fo->done)
+			pthread_cond_wait(&fo->cond, &fo->lock);
+
+		b = t->next;
+		if (b == NULL)
+			break;
+		pthread_mutex_unlock(&fo->lock);
+
+		/* a failed device only lets the batches go */
+		buf = t->dev.emu != NULL && b->flash ? b->phys : b->buf;
+		if (!t->error && mtd_prog_write(&t->prog, buf, b->pages) < 0)
+			t->error = errno ? errno : EIO;
+
+		pthread_mutex_lock(&fo->lock);
+		t->pages += b->pages;
+		t->next = b->next;
+		mtd_fanout_put(fo, b);
+		pthread_cond_broadcast(&fo->cond);
+	}
+	pthread_mutex_unlock(&fo->lock);
+
+	if (!t->error && mtd_prog_finish(&t->prog, 1) < 0)
+		t->error = errno ? errno : EIO;
+
+	pthread_mutex_lock(&fo->lock);
+	fo->running--;
+	pthread_cond_broadcast(&fo->cond);
+	pthread_mutex_unlock(&fo->lock);
+
+	return NULL;
+}
+
+int
+mtd_fanout_start (struct mtd_fanout *fo, struct mtd_target *targets,
+		  unsigned n, unsigned chunksize, unsigned sparesize,
+		  int raw, unsigned batch_pages, size_t queue)
+{
+	unsigned i;
+
+	memset(fo, 0, sizeof(*fo));
+	pthread_mutex_init(&fo->lock, NULL);
+	pthread_cond_init(&fo->cond, NULL);
+
+	fo->targets = targets;
+	fo->n = n;
+	fo->page_sz = chunksize + sparesize;
+	fo->batch_pages = batch_pages;
+	fo->max_batches = queue / (fo->page_sz * batch_pages);
+	if (fo->max_batches < 2)
+		fo->max_batches = 2;
+
+	for (i = 0; i < n; i++) {
+		targets[i].fanout = fo;
+		targets[i].next = NULL;
+		targets[i].pages = 0;
+		targets[i].error = 0;
+		if (mtd_prog_start(&targets[i].prog, &targets[i].dev,
+				   chunksize, sparesize, raw) < 0)
+			return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (pthread_create(&targets[i].tid, NULL, mtd_fanout_worker,
+				   &targets[i])) {
+			mtd_fanout_finish(fo, NULL);
+			errno = EAGAIN;
+			return -1;
+		}
+		fo->threads++;
+		fo->running++;
+	}
+
+	return 0;
+}
+
+static struct mtd_batch *
+mtd_fanout_get (struct mtd_fanout *fo)
+{
+	struct mtd_batch *b;
+
+	pthread_mutex_lock(&fo->lock);
+	while (fo->free == NULL && fo->batches >= fo->max_batches)
+		pthread_cond_wait(&fo->cond, &fo->lock);
+
+	b = fo->free;
+	if (b != NULL) {
+		fo->free = b->next;
+	}
+	else {
+		b = calloc(1, sizeof(*b));
+		if (b != NULL)
+			fo->batches++;
+	}
+	pthread_mutex_unlock(&fo->lock);
+
+	return b;
+}
+
+int
+mtd_fanout_write (struct mtd_fanout *fo, const unsigned char *buf,
+		  const unsigned char *phys, unsigned pages)
+{
+	unsigned i, failed = 0;
+	size_t size = fo->page_sz * fo->batch_pages;
+	struct mtd_batch *b;
+
+	for (i = 0; i < fo->n; i++)
+		failed += fo->targets[i].error != 0;
+	if (failed == fo->n) {
+		errno = fo->targets[0].error;
+		return -1;
+	}
+
+	b = mtd_fanout_get(fo);
+	if (b == NULL)
+		return -1;
+
+	/* the buffers come with the batch, and stay with it */
+	if ((b->buf == NULL && (b->buf = malloc(size)) == NULL) ||
+	    (phys && b->phys == NULL && (b->phys = malloc(size)) == NULL)) {
+		pthread_mutex_lock(&fo->lock);
+		b->refs = 1;
+		mtd_fanout_put(fo, b);
+		pthread_mutex_unlock(&fo->lock);
+		return -1;
+	}
+
+	memcpy(b->buf, buf, fo->page_sz * pages);
+	if (phys)
+		memcpy(b->phys, phys, fo->page_sz * pages);
+	b->flash = phys != NULL;
+	b->pages = pages;
+	b->refs = fo->n + 1;		/* and one for the tail */
+	b->next = NULL;
+
+	pthread_mutex_lock(&fo->lock);
+	if (fo->tail) {
+		fo->tail->next = b;
+		mtd_fanout_put(fo, fo->tail);
+	}
+	for (i = 0; i < fo->n; i++) {
+		if (fo->targets[i].next == NULL)
+			fo->targets[i].next = b;
+	}
+	fo->tail = b;
+	fo->pages += pages;
+	pthread_cond_broadcast(&fo->cond);
+	pthread_mutex_unlock(&fo->lock);
+
+	return 0;
+}
+
+int
+mtd_fanout_finish (struct mtd_fanout *fo,
+		   void (*progress) (unsigned long long, unsigned long long))
+{
+	unsigned i;
+	unsigned long long slowest;
+	int retval = 0;
+
+	pthread_mutex_lock(&fo->lock);
+	fo->done = 1;
+	pthread_cond_broadcast(&fo->cond);
+	while (fo->running) {
+		if (progress) {
+			slowest = fo->pages;
+			for (i = 0; i < fo->n; i++) {
+				if (!fo->targets[i].error &&
+				    fo->targets[i].pages < slowest)
+					slowest = fo->targets[i].pages;
+			}
+			progress(slowest, fo->pages);
+		}
+		pthread_cond_wait(&fo->cond, &fo->lock);
+	}
+
+	if (fo->tail) {
+		mtd_fanout_put(fo, fo->tail);
+		fo->tail = NULL;
+	}
+	pthread_mutex_unlock(&fo->lock);
+
+	for (i = 0; i < fo->threads; i++)
+		pthread_join(fo->targets[i].tid, NULL);
+
+	for (i = 0; i < fo->n; i++) {
+		if (fo->targets[i].error)
+			retval = -1;
+	}
+
+	return retval;
+}
+
+void
+mtd_fanout_release (struct mtd_fanout *fo)
+{
+	unsigned i;
+	struct mtd_batch *b;
+
+	if (fo->targets == NULL)
+		return;
+
+	while ((b = fo->free) != NULL) {
+		fo->free = b->next;
+		free(b->buf);
+		free(b->phys);
+		free(b);
+	}
+
+	for (i = 0; i < fo->n; i++)
+		mtd_prog_release(&fo->targets[i].prog);
+
+	pthread_mutex_destroy(&fo->lock);
+	pthread_cond_destroy(&fo->cond);
+}
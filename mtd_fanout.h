@@ -0,0 +1,102 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_MTD_FANOUT_H__
+#define __YAFFS2UTILS_MTD_FANOUT_H__
+
+#include <pthread.h>
+
+#include "mtd_dev.h"
+#include "mtd_prog.h"
+
+#define MTD_FANOUT_QUEUE	(64 << 20)	/* bytes of batches queued */
+
+/*
+ * One stream of pages programmed to many devices at once. Every device
+ * has a thread of its own taking the batches in order from a shared queue,
+ * so the pages are made once whatever the number of devices, and a slow
+ * device holds the others back only when it falls behind by a whole queue.
+ * A batch is recycled once every device has programmed it; a device that
+ * fails drops out and the others carry on.
+ */
+typedef struct mtd_batch {
+	unsigned refs;
+	unsigned pages;
+	unsigned char *buf;		/* the pages as Linux keeps them */
+	unsigned char *phys;		/* as the flash has them */
+	int flash;			/* 'phys' differs from 'buf' */
+	struct mtd_batch *next;
+} mtd_batch_t;
+
+typedef struct mtd_target {
+	const char *path;
+	struct mtd_dev dev;		/* opened by the caller */
+	struct mtd_prog prog;
+	struct mtd_fanout *fanout;
+	pthread_t tid;
+	struct mtd_batch *next;		/* next batch to program */
+	unsigned long long pages;	/* pages taken from the queue */
+	int error;			/* errno of the failure, or 0 */
+} mtd_target_t;
+
+typedef struct mtd_fanout {
+	struct mtd_target *targets;
+	unsigned n;
+	unsigned threads;		/* of the targets, started */
+	unsigned running;		/* and not done yet */
+	size_t page_sz;			/* chunk + spare of the stream */
+	unsigned batch_pages;
+	unsigned batches;		/* allocated */
+	unsigned max_batches;
+	struct mtd_batch *free;
+	struct mtd_batch *tail;		/* held until the next one comes */
+	unsigned long long pages;	/* pages queued */
+	int done;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;		/* any change of the above */
+} mtd_fanout_t;
+
+/*
+ * Start a thread for each of the 'n' opened devices, programming pages of
+ * 'chunksize' bytes of data and 'sparesize' of spare (see mtd_prog), in
+ * batches of up to 'batch_pages', with 'queue' bytes of them at most.
+ */
+int mtd_fanout_start (struct mtd_fanout *fo, struct mtd_target *targets,
+		      unsigned n, unsigned chunksize, unsigned sparesize,
+		      int raw, unsigned batch_pages, size_t queue);
+
+/*
+ * Queue a batch of pages; 'phys' is the same pages as the flash holds
+ * them, for the files emulating the devices. Returns -1 once every
+ * device has failed.
+ */
+int mtd_fanout_write (struct mtd_fanout *fo, const unsigned char *buf,
+		      const unsigned char *phys, unsigned pages);
+
+/*
+ * Wait for all the devices to finish, erasing the rest of them; 'progress'
+ * is told the pages programmed by the slowest one still going, and all.
+ * Returns -1 if any device failed.
+ */
+int mtd_fanout_finish (struct mtd_fanout *fo,
+		       void (*progress) (unsigned long long,
+					 unsigned long long));
+void mtd_fanout_release (struct mtd_fanout *fo);
+
+#endif
@@ -0,0 +1,166 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mtd_prog.h"
+
+/*----------------------------------------------------------------------------*/
+
+int
+mtd_prog_start (struct mtd_prog *prog, struct mtd_dev *dev,
+		unsigned chunksize, unsigned sparesize, int raw)
+{
+	memset(prog, 0, sizeof(*prog));
+
+	if (chunksize != dev->writesize || sparesize > dev->oobsize) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	prog->dev = dev;
+	prog->chunksize = chunksize;
+	prog->sparesize = sparesize;
+	prog->raw = raw;
+
+	prog->data = malloc(dev->erasesize);
+	prog->oob = malloc((size_t)dev->pages_per_block * dev->oobsize);
+	if (prog->data == NULL || prog->oob == NULL) {
+		mtd_prog_release(prog);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+mtd_prog_erased (const unsigned char *buf, unsigned size)
+{
+	return size == 0 || (buf[0] == 0xff && !memcmp(buf, buf + 1, size - 1));
+}
+
+/* the next good block, or -1 when the device is used up */
+static int
+mtd_prog_next_good (struct mtd_prog *prog)
+{
+	int bad;
+
+	for (; prog->block < prog->dev->blocks; prog->block++) {
+		bad = mtd_dev_isbad(prog->dev, prog->block);
+		if (bad < 0)
+			return -1;
+		if (!bad)
+			return 0;
+		prog->bad++;
+	}
+
+	errno = ENOSPC;
+	return -1;
+}
+
+static int
+mtd_prog_block (struct mtd_prog *prog)
+{
+	struct mtd_dev *dev = prog->dev;
+
+	while (mtd_prog_next_good(prog) == 0) {
+		if (mtd_dev_erase(dev, prog->block) == 0 &&
+		    (prog->used == 0 ||
+		     mtd_dev_write(dev, prog->block, prog->data, prog->oob,
+				   prog->used, prog->raw) == 0)) {
+			prog->block++;
+			prog->programmed++;
+			prog->pages = prog->used = 0;
+			return 0;
+		}
+
+		/* worn out: the same pages go to the next good block */
+		if (errno != EIO || mtd_dev_markbad(dev, prog->block) < 0)
+			return -1;
+		prog->failed++;
+		prog->block++;
+	}
+
+	return -1;
+}
+
+int
+mtd_prog_write (struct mtd_prog *prog, const unsigned char *buf,
+		unsigned pages)
+{
+	struct mtd_dev *dev = prog->dev;
+	unsigned char *data, *oob;
+
+	for (; pages; pages--, buf += prog->chunksize + prog->sparesize) {
+		data = prog->data + (size_t)prog->pages * dev->writesize;
+		oob = prog->oob + (size_t)prog->pages * dev->oobsize;
+
+		memcpy(data, buf, prog->chunksize);
+		memcpy(oob, buf + prog->chunksize, prog->sparesize);
+		memset(oob + prog->sparesize, 0xff,
+		       dev->oobsize - prog->sparesize);
+
+		prog->pages++;
+		if (!mtd_prog_erased(data, dev->writesize) ||
+		    !mtd_prog_erased(oob, dev->oobsize))
+			prog->used = prog->pages;
+
+		if (prog->pages == dev->pages_per_block &&
+		    mtd_prog_block(prog) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int
+mtd_prog_finish (struct mtd_prog *prog, int erase_rest)
+{
+	int bad;
+
+	if (prog->pages && mtd_prog_block(prog) < 0)
+		return -1;
+
+	/* nothing stale from before may be taken for the file system */
+	for (; erase_rest && prog->block < prog->dev->blocks; prog->block++) {
+		bad = mtd_dev_isbad(prog->dev, prog->block);
+		if (bad < 0)
+			return -1;
+		if (bad)
+			continue;
+
+		if (mtd_dev_erase(prog->dev, prog->block) < 0) {
+			if (errno != EIO ||
+			    mtd_dev_markbad(prog->dev, prog->block) < 0)
+				return -1;
+			prog->failed++;
+		}
+	}
+
+	return 0;
+}
+
+void
+mtd_prog_release (struct mtd_prog *prog)
+{
+	free(prog->data);
+	free(prog->oob);
+	prog->data = prog->oob = NULL;
+}
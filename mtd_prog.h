@@ -0,0 +1,61 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_MTD_PROG_H__
+#define __YAFFS2UTILS_MTD_PROG_H__
+
+#include "mtd_dev.h"
+
+/*
+ * Program a stream of pages to an MTD device, a block at a time: the pages
+ * of an image block are gathered, the next good block of the device is
+ * erased and programmed with all of them in one request. A block failing
+ * to erase or program is marked bad and the same pages go to the next one,
+ * so the image blocks land on the good blocks in order, as "nandwrite -a"
+ * would put them. The erased pages at the end of a block are left out.
+ */
+typedef struct mtd_prog {
+	struct mtd_dev *dev;
+	unsigned chunksize;		/* data bytes of a page in the stream */
+	unsigned sparesize;		/* followed by its spare, or none */
+	int raw;
+	unsigned block;			/* next block of the device */
+	unsigned pages;			/* pages gathered */
+	unsigned used;			/* up to the last page not erased */
+	unsigned char *data;		/* a block of data */
+	unsigned char *oob;		/* and its oob */
+
+	unsigned programmed;		/* blocks of the image */
+	unsigned bad;			/* bad blocks skipped */
+	unsigned failed;		/* blocks gone bad on the way */
+} mtd_prog_t;
+
+/*
+ * The pages of the stream are 'chunksize' bytes of data, as many as the
+ * device writes, and 'sparesize' bytes of spare which begin the oob.
+ */
+int mtd_prog_start (struct mtd_prog *prog, struct mtd_dev *dev,
+		    unsigned chunksize, unsigned sparesize, int raw);
+int mtd_prog_write (struct mtd_prog *prog, const unsigned char *buf,
+		    unsigned pages);
+
+/* program the last block, and erase the rest of the device if asked */
+int mtd_prog_finish (struct mtd_prog *prog, int erase_rest);
+void mtd_prog_release (struct mtd_prog *prog);
+
+#endif
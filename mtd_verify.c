@@ -0,0 +1,333 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "configs.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "mtd_verify.h"
+
+/*----------------------------------------------------------------------------*/
+
+int
+mtd_verify_start (struct mtd_verify *v, struct mtd_dev *dev,
+		  unsigned chunksize, unsigned sparesize, int raw,
+		  const nand_ecclayout_t *layout)
+{
+	unsigned i, pagesize = chunksize + sparesize;
+
+	memset(v, 0, sizeof(*v));
+
+	if (chunksize != dev->writesize || sparesize > dev->oobsize) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_init(&v->lock, NULL);
+	pthread_cond_init(&v->cond, NULL);
+	v->dev = dev;
+	v->chunksize = chunksize;
+	v->sparesize = sparesize;
+	v->raw = raw;
+
+	v->mask = malloc(dev->oobsize);
+	v->image = malloc((size_t)dev->pages_per_block * pagesize);
+	v->page = malloc(pagesize);
+	v->oob = malloc(dev->oobsize);
+	v->erased = malloc(dev->writesize);
+	if (v->mask == NULL || v->image == NULL || v->page == NULL ||
+	    v->oob == NULL || v->erased == NULL)
+		goto free_and_out;
+	memset(v->erased, 0xff, dev->writesize);
+
+	for (i = 0; i < MTD_VERIFY_DEPTH; i++) {
+		v->slots[i].data = malloc(dev->erasesize);
+		v->slots[i].oob = malloc((size_t)dev->pages_per_block *
+					 dev->oobsize);
+		if (v->slots[i].data == NULL || v->slots[i].oob == NULL)
+			goto free_and_out;
+	}
+
+	/* the driver puts its own ecc in the oob, and the rest is its own */
+	if (raw) {
+		memset(v->mask, 1, dev->oobsize);
+	} else {
+		memset(v->mask, 0, dev->oobsize);
+		memset(v->mask, 1, sparesize);
+		for (i = 0; layout != NULL && i < layout->eccbytes; i++) {
+			if (layout->eccpos[i] < dev->oobsize)
+				v->mask[layout->eccpos[i]] = 0;
+		}
+	}
+
+	return 0;
+
+free_and_out:
+	mtd_verify_release(v);
+	return -1;
+}
+
+void
+mtd_verify_release (struct mtd_verify *v)
+{
+	unsigned i;
+
+	if (v->dev == NULL)
+		return;
+
+	for (i = 0; i < MTD_VERIFY_DEPTH; i++) {
+		free(v->slots[i].data);
+		free(v->slots[i].oob);
+	}
+
+	free(v->mask);
+	free(v->image);
+	free(v->page);
+	free(v->oob);
+	free(v->erased);
+	pthread_mutex_destroy(&v->lock);
+	pthread_cond_destroy(&v->cond);
+	v->dev = NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* the good blocks of the device in order, read ahead into the slots */
+static void *
+mtd_verify_reader (void *data)
+{
+	struct mtd_verify *v = data;
+	struct mtd_dev *dev = v->dev;
+	struct mtd_verify_slot *s;
+	unsigned n, block = 0;
+	int bad = 0, stop;
+
+	for (n = 0; n < v->blocks && bad >= 0; n++) {
+		pthread_mutex_lock(&v->lock);
+		while (v->queued == MTD_VERIFY_DEPTH && !v->stop)
+			pthread_cond_wait(&v->cond, &v->lock);
+		stop = v->stop;
+		pthread_mutex_unlock(&v->lock);
+		if (stop)
+			break;
+
+		s = &v->slots[n % MTD_VERIFY_DEPTH];
+		for (; block < dev->blocks; block++) {
+			bad = mtd_dev_isbad(dev, block);
+			if (bad <= 0)
+				break;
+			v->bad++;
+		}
+
+		if (block == dev->blocks) {
+			bad = -1;
+			errno = ENOSPC;
+		}
+
+		if (bad < 0) {
+			s->result = -1;
+		} else {
+			s->block = block;
+			s->result = mtd_dev_read(dev, block++, s->data, s->oob,
+						 dev->pages_per_block, v->raw);
+		}
+		s->error = errno;
+
+		pthread_mutex_lock(&v->lock);
+		v->queued++;
+		pthread_cond_broadcast(&v->cond);
+		pthread_mutex_unlock(&v->lock);
+	}
+
+	return NULL;
+}
+
+/* the bytes of the oob left out of the comparison read as 0xff */
+static void
+mtd_verify_mask (const struct mtd_verify *v, unsigned char *oob,
+		 unsigned pages)
+{
+	unsigned i, j, oobsize = v->dev->oobsize;
+
+	if (v->raw)
+		return;
+
+	for (i = 0; i < pages; i++, oob += oobsize) {
+		for (j = 0; j < oobsize; j++) {
+			if (!v->mask[j])
+				oob[j] = 0xff;
+		}
+	}
+}
+
+/* the oob expected of a page of the stream, 0xff past its spare */
+static void
+mtd_verify_expect (struct mtd_verify *v, const unsigned char *page)
+{
+	unsigned oobsize = v->dev->oobsize;
+
+	if (page != NULL)
+		memcpy(v->oob, page + v->chunksize, v->sparesize);
+	else
+		memset(v->oob, 0xff, v->sparesize);
+	memset(v->oob + v->sparesize, 0xff, oobsize - v->sparesize);
+	mtd_verify_mask(v, v->oob, 1);
+}
+
+/* a page which differs from the stream, corrected if it can be */
+static int
+mtd_verify_page (struct mtd_verify *v, const unsigned char *page,
+		 const unsigned char *data, const unsigned char *oob)
+{
+	const unsigned char *want = page != NULL ? page : v->erased;
+	unsigned oobsize = v->dev->oobsize;
+	int result;
+
+	mtd_verify_expect(v, page);
+	if (!memcmp(data, want, v->chunksize) &&
+	    !memcmp(oob, v->oob, oobsize))
+		return 0;
+
+	if (v->correct == NULL ||
+	    memcmp(oob + v->sparesize, v->oob + v->sparesize,
+		   oobsize - v->sparesize))
+		return -1;
+
+	memcpy(v->page, data, v->chunksize);
+	memcpy(v->page + v->chunksize, oob, v->sparesize);
+	result = v->correct(v->arg, v->page);
+	if (result < 0 ||
+	    memcmp(v->page, want, v->chunksize) ||
+	    memcmp(v->page + v->chunksize, v->oob, v->sparesize))
+		return -1;
+
+	return result;
+}
+
+/* 0 if the block read matches the 'pages' pages of the image block */
+static int
+mtd_verify_block (struct mtd_verify *v, struct mtd_verify_slot *s,
+		  unsigned pages)
+{
+	struct mtd_dev *dev = v->dev;
+	unsigned i, pagesize = v->chunksize + v->sparesize;
+	unsigned oobsize = dev->oobsize;
+	uint32_t data = 0, oob = 0;
+	const unsigned char *page;
+	int result, corrected = 0;
+
+	mtd_verify_mask(v, s->oob, dev->pages_per_block);
+
+	for (i = 0; i < dev->pages_per_block; i++) {
+		page = i < pages ? v->image + (size_t)i * pagesize : NULL;
+		mtd_verify_expect(v, page);
+		data = crc32c(data, page != NULL ? page : v->erased,
+			      v->chunksize);
+		oob = crc32c(oob, v->oob, oobsize);
+	}
+
+	if (data == crc32c(0, s->data, dev->erasesize) &&
+	    oob == crc32c(0, s->oob, (size_t)dev->pages_per_block * oobsize))
+		return 0;
+
+	/* which pages, and whether the flips are those the ecc corrects */
+	for (i = 0; i < dev->pages_per_block; i++) {
+		page = i < pages ? v->image + (size_t)i * pagesize : NULL;
+		result = mtd_verify_page(v, page,
+					 s->data + (size_t)i * dev->writesize,
+					 s->oob + (size_t)i * oobsize);
+		if (result < 0)
+			return -1;
+		corrected += result;
+	}
+
+	v->corrected += corrected;
+
+	return 0;
+}
+
+int
+mtd_verify_image (struct mtd_verify *v, int fd, unsigned pages,
+		  void (*progress) (unsigned, unsigned))
+{
+	struct mtd_dev *dev = v->dev;
+	unsigned n, ppb = dev->pages_per_block;
+	unsigned pagesize = v->chunksize + v->sparesize;
+	struct mtd_verify_slot *s;
+	pthread_t tid;
+	size_t size;
+	int retval = 0;
+
+	v->blocks = (pages + ppb - 1) / ppb;
+	v->queued = 0;
+	v->stop = 0;
+
+	if (pthread_create(&tid, NULL, mtd_verify_reader, v))
+		return -1;
+
+	for (n = 0; n < v->blocks; n++) {
+		pthread_mutex_lock(&v->lock);
+		while (v->queued == 0)
+			pthread_cond_wait(&v->cond, &v->lock);
+		pthread_mutex_unlock(&v->lock);
+
+		/* an uncorrectable read still has its data compared */
+		s = &v->slots[n % MTD_VERIFY_DEPTH];
+		if (s->result < 0 && s->error != EBADMSG) {
+			errno = s->error;
+			retval = -1;
+			break;
+		}
+		if (s->result > 0)
+			v->corrected += s->result;
+
+		size = (size_t)(pages - n * ppb < ppb ? pages - n * ppb : ppb) *
+		       pagesize;
+		if (pread(fd, v->image, size, (off_t)n * ppb * pagesize) !=
+		    size) {
+			retval = -1;
+			break;
+		}
+
+		if (mtd_verify_block(v, s, size / pagesize) < 0) {
+			v->mismatched++;
+			if (v->report)
+				v->report(v->arg, n, s->block);
+		}
+
+		pthread_mutex_lock(&v->lock);
+		v->queued--;
+		pthread_cond_broadcast(&v->cond);
+		pthread_mutex_unlock(&v->lock);
+
+		if (progress)
+			progress(n + 1, v->blocks);
+	}
+
+	pthread_mutex_lock(&v->lock);
+	v->stop = 1;
+	pthread_cond_broadcast(&v->cond);
+	pthread_mutex_unlock(&v->lock);
+	pthread_join(tid, NULL);
+
+	return retval;
+}
@@ -0,0 +1,94 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_MTD_VERIFY_H__
+#define __YAFFS2UTILS_MTD_VERIFY_H__
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mtd_dev.h"
+
+#define MTD_VERIFY_DEPTH	4	/* blocks read ahead of the hashing */
+
+typedef struct mtd_verify_slot {
+	unsigned block;			/* of the device */
+	int result;			/* of mtd_dev_read() */
+	int error;
+	unsigned char *data;
+	unsigned char *oob;
+} mtd_verify_slot_t;
+
+/*
+ * Check an MTD device, or a dump of one, against the stream of pages it
+ * was programmed with by mtd_prog: the image blocks are looked for on the
+ * good blocks in order. A reader thread keeps MTD_VERIFY_DEPTH blocks read
+ * ahead, while the CRC-32C of every block read is compared with that of
+ * the image block; only a block whose CRC differs is compared page by
+ * page. The ecc of the driver corrects the bit flips of non-raw reads;
+ * for raw ones, 'correct' may take a page of the stream which differs.
+ */
+typedef struct mtd_verify {
+	struct mtd_dev *dev;
+	unsigned chunksize;		/* data bytes of a page in the stream */
+	unsigned sparesize;		/* followed by its spare, or none */
+	int raw;
+	unsigned char *mask;		/* the oob bytes compared */
+
+	/* bits corrected in the page, or -1 */
+	int (*correct) (void *arg, unsigned char *page);
+	/* an image block which does not match */
+	void (*report) (void *arg, unsigned block, unsigned devblock);
+	void *arg;
+
+	unsigned blocks;		/* of the image */
+	unsigned bad;			/* bad blocks skipped */
+	unsigned corrected;		/* bit flips corrected */
+	unsigned mismatched;		/* blocks not matching */
+
+	struct mtd_verify_slot slots[MTD_VERIFY_DEPTH];
+	unsigned queued;		/* slots read, not checked yet */
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	unsigned char *image;		/* an image block */
+	unsigned char *page;		/* a page of the stream */
+	unsigned char *oob;		/* the oob expected of a page */
+	unsigned char *erased;		/* a page of 0xff */
+} mtd_verify_t;
+
+/*
+ * The pages of the stream are those of mtd_prog_start(). Reads go through
+ * the ecc of the driver unless 'raw'; then only the oob bytes in the spare
+ * which are not in the eccpos of 'layout' are compared.
+ */
+int mtd_verify_start (struct mtd_verify *v, struct mtd_dev *dev,
+		      unsigned chunksize, unsigned sparesize, int raw,
+		      const nand_ecclayout_t *layout);
+
+/*
+ * Verify the device against the 'pages' pages of the image 'fd'. Returns
+ * -1 when the device cannot be read or runs out of good blocks; blocks
+ * which do not match are counted in 'mismatched'.
+ */
+int mtd_verify_image (struct mtd_verify *v, int fd, unsigned pages,
+		      void (*progress) (unsigned, unsigned));
+void mtd_verify_release (struct mtd_verify *v);
+
+#endif
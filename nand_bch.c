@@ -0,0 +1,459 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * BCH encoder/decoder compatible with the Linux lib/bch and nand_bch.
+ *
+ * The data of a step is the high-order part of the codeword, msb of the
+ * first byte first; the parity is the remainder of data(x) * x^ecc_bits
+ * modulo the generator polynomial. The remainder is kept left-aligned in
+ * 32-bit words and advanced 32 data bits at a time with four 256-entry
+ * tables (slicing-by-4), as lib/bch does.
+ *
+ * Decoding re-encodes the data first: a step whose parity matches is clean
+ * and costs no more than the encoder. Otherwise the syndromes are taken
+ * from the parity difference, which is e(x) mod g(x), then the error
+ * locator is found by Berlekamp-Massey and its roots by a Chien search.
+ */
+
+#include "configs.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nand_bch.h"
+
+#define NAND_BCH_MIN_M		5
+#define NAND_BCH_MAX_M		16
+#define NAND_BCH_MAX_WORDS	(NAND_BCH_MAX_BYTES / 4)
+#define NAND_BCH_MAX_T		(NAND_BCH_MAX_BYTES * 8 / NAND_BCH_MIN_M)
+
+/*----------------------------------------------------------------------------*/
+
+struct nand_bch {
+	unsigned m;			/* GF(2^m) */
+	unsigned n;			/* 2^m - 1, the full code length */
+	unsigned t;			/* correctable bits per step */
+	unsigned step;			/* data bytes per step */
+	unsigned ecc_bits;
+	unsigned ecc_bytes;
+	unsigned ecc_words;
+
+	uint16_t *a_pow;		/* alpha^i */
+	uint16_t *a_log;		/* log_alpha(x) */
+	uint32_t *mod_tab;		/* 4 x 256 remainders, ecc_words each */
+
+	unsigned char eccmask[NAND_BCH_MAX_BYTES];
+};
+
+/* default primitive polynomials of lib/bch, for m = 5 .. 16 */
+static const unsigned nand_bch_prim_poly[] = {
+	0x25, 0x43, 0x83, 0x11d, 0x211, 0x409, 0x805, 0x1053, 0x201b,
+	0x402b, 0x8003, 0x1002d,
+};
+
+/*----------------------------------------------------------------------------*/
+
+static inline unsigned
+nand_bch_fls (unsigned x)
+{
+	return x ? 32 - __builtin_clz(x) : 0;
+}
+
+static int
+nand_bch_build_gf (struct nand_bch *bch)
+{
+	unsigned i, x = 1;
+	unsigned poly = nand_bch_prim_poly[bch->m - NAND_BCH_MIN_M];
+
+	bch->a_pow = malloc((bch->n + 1) * sizeof(uint16_t));
+	bch->a_log = malloc((bch->n + 1) * sizeof(uint16_t));
+	if (bch->a_pow == NULL || bch->a_log == NULL)
+		return -1;
+
+	for (i = 0; i < bch->n; i++) {
+		bch->a_pow[i] = x;
+		bch->a_log[x] = i;
+		x <<= 1;
+		if (x & (1 << bch->m))
+			x ^= poly;
+	}
+	bch->a_pow[bch->n] = 1;
+	bch->a_log[0] = 0;
+
+	return 0;
+}
+
+/*
+ * g(x) is the product of (x - alpha^r) over the cyclotomic cosets of
+ * alpha^1, alpha^3, ..., alpha^(2t-1). The result is stored without its
+ * leading term, left-aligned: bit 31 of gen[0] is the x^(ecc_bits-1) term.
+ */
+static int
+nand_bch_build_genpoly (struct nand_bch *bch, uint32_t *gen)
+{
+	unsigned i, j, r, deg = 0;
+	unsigned char *roots;
+	unsigned *g;
+	int retval = -1;
+
+	roots = calloc(bch->n, sizeof(unsigned char));
+	g = calloc(bch->m * bch->t + 1, sizeof(unsigned));
+	if (roots == NULL || g == NULL)
+		goto free_and_out;
+
+	for (i = 0; i < bch->t; i++) {
+		for (j = 0, r = 2 * i + 1; j < bch->m; j++) {
+			roots[r] = 1;
+			r = (r * 2) % bch->n;
+		}
+	}
+
+	g[0] = 1;
+	for (r = 0; r < bch->n; r++) {
+		if (!roots[r])
+			continue;
+
+		/* g(x) *= (x + alpha^r) */
+		g[++deg] = 1;
+		for (j = deg - 1; j > 0; j--) {
+			g[j] = g[j - 1] ^ (g[j] ? bch->a_pow[(bch->a_log[g[j]] +
+					  r) % bch->n] : 0);
+		}
+		g[0] = bch->a_pow[(bch->a_log[g[0]] + r) % bch->n];
+	}
+
+	bch->ecc_bits = deg;
+	bch->ecc_bytes = (deg + 7) / 8;
+	bch->ecc_words = (deg + 31) / 32;
+	if (bch->ecc_bytes > NAND_BCH_MAX_BYTES)
+		goto free_and_out;
+
+	memset(gen, 0, NAND_BCH_MAX_WORDS * sizeof(uint32_t));
+	for (i = 0; i < deg; i++) {
+		if (g[deg - 1 - i] > 1)
+			goto free_and_out;	/* not a binary polynomial */
+		if (g[deg - 1 - i])
+			gen[i / 32] |= 1u << (31 - i % 32);
+	}
+
+	retval = 0;
+
+free_and_out:
+	free(g);
+	free(roots);
+
+	return retval;
+}
+
+/* shift one data bit into the remainder, the slow way */
+static void
+nand_bch_lfsr (const struct nand_bch *bch, const uint32_t *gen,
+	       uint32_t *r, unsigned bit)
+{
+	unsigned i, fb = (r[0] >> 31) ^ bit;
+
+	for (i = 0; i < bch->ecc_words - 1; i++)
+		r[i] = (r[i] << 1) | (r[i + 1] >> 31);
+	r[i] <<= 1;
+
+	if (fb) {
+		for (i = 0; i < bch->ecc_words; i++)
+			r[i] ^= gen[i];
+	}
+}
+
+/* mod_tab[k][v] = v(x) * x^(ecc_bits + 8k) mod g(x) */
+static int
+nand_bch_build_mod_tab (struct nand_bch *bch, const uint32_t *gen)
+{
+	unsigned k, v, b, l = bch->ecc_words;
+	uint32_t *p;
+
+	bch->mod_tab = malloc(4 * 256 * l * sizeof(uint32_t));
+	if (bch->mod_tab == NULL)
+		return -1;
+
+	for (k = 0; k < 4; k++) {
+		for (v = 0; v < 256; v++) {
+			p = bch->mod_tab + (k * 256 + v) * l;
+			memset(p, 0, l * sizeof(uint32_t));
+			for (b = 0; b < 8; b++)
+				nand_bch_lfsr(bch, gen, p, (v >> (7 - b)) & 1);
+			for (b = 0; b < 8 * k; b++)
+				nand_bch_lfsr(bch, gen, p, 0);
+		}
+	}
+
+	return 0;
+}
+
+static inline unsigned
+nand_bch_mul (const struct nand_bch *bch, unsigned a, unsigned b)
+{
+	return (a && b) ? bch->a_pow[(bch->a_log[a] + bch->a_log[b]) %
+				     bch->n] : 0;
+}
+
+static inline unsigned
+nand_bch_div (const struct nand_bch *bch, unsigned a, unsigned b)
+{
+	return a ? bch->a_pow[(bch->a_log[a] + bch->n - bch->a_log[b]) %
+			      bch->n] : 0;
+}
+
+/* S[1 .. 2t] of the parity difference, the x^(ecc_bits-1) term first */
+static void
+nand_bch_syndromes (const struct nand_bch *bch, const unsigned char *diff,
+		    unsigned *s)
+{
+	unsigned i, j, d;
+
+	memset(s, 0, (2 * bch->t + 1) * sizeof(unsigned));
+
+	for (j = 0; j < bch->ecc_bits; j++) {
+		if (!(diff[j / 8] & (0x80 >> (j % 8))))
+			continue;
+
+		d = bch->ecc_bits - 1 - j;
+		for (i = 1; i < 2 * bch->t; i += 2)
+			s[i] ^= bch->a_pow[(i * d) % bch->n];
+	}
+
+	/* binary code: S(2i) = S(i)^2 */
+	for (i = 2; i <= 2 * bch->t; i += 2)
+		s[i] = nand_bch_mul(bch, s[i / 2], s[i / 2]);
+}
+
+/* error locator of S[1 .. 2t] into elp[0 .. t], returns its degree */
+static int
+nand_bch_berlekamp_massey (const struct nand_bch *bch, const unsigned *s,
+			   unsigned *elp)
+{
+	unsigned i, k, d, coef, b = 1, l = 0, shift = 1;
+	unsigned prev[NAND_BCH_MAX_T + 1], tmp[NAND_BCH_MAX_T + 1];
+	size_t size = (bch->t + 1) * sizeof(unsigned);
+
+	memset(elp, 0, size);
+	memset(prev, 0, size);
+	elp[0] = prev[0] = 1;
+
+	for (k = 0; k < 2 * bch->t; k++) {
+		/* discrepancy */
+		d = s[k + 1];
+		for (i = 1; i <= l; i++)
+			d ^= nand_bch_mul(bch, elp[i], s[k + 1 - i]);
+
+		if (d == 0) {
+			shift++;
+			continue;
+		}
+
+		/* elp(x) -= d / b * x^shift * prev(x) */
+		memcpy(tmp, elp, size);
+		coef = nand_bch_div(bch, d, b);
+		for (i = 0; i + shift <= bch->t; i++)
+			elp[i + shift] ^= nand_bch_mul(bch, coef, prev[i]);
+
+		if (2 * l <= k) {
+			l = k + 1 - l;
+			if (l > bch->t)
+				return -1;
+			memcpy(prev, tmp, size);
+			b = d;
+			shift = 1;
+		}
+		else {
+			shift++;
+		}
+	}
+
+	return l;
+}
+
+/*----------------------------------------------------------------------------*/
+
+struct nand_bch *
+nand_bch_init (unsigned step, unsigned strength)
+{
+	unsigned i;
+	struct nand_bch *bch;
+	uint32_t gen[NAND_BCH_MAX_WORDS];
+	unsigned char *erased;
+
+	if (step == 0 || strength == 0)
+		return NULL;
+
+	bch = calloc(sizeof(struct nand_bch), sizeof(unsigned char));
+	if (bch == NULL)
+		return NULL;
+
+	bch->m = nand_bch_fls(1 + 8 * step);
+	bch->n = (1 << bch->m) - 1;
+	bch->t = strength;
+	bch->step = step;
+
+	if (bch->m < NAND_BCH_MIN_M || bch->m > NAND_BCH_MAX_M ||
+	    bch->m * bch->t > NAND_BCH_MAX_BYTES * 8 ||
+	    nand_bch_build_gf(bch) < 0 ||
+	    nand_bch_build_genpoly(bch, gen) < 0 ||
+	    step * 8 + bch->ecc_bits > bch->n ||
+	    nand_bch_build_mod_tab(bch, gen) < 0)
+		goto free_and_out;
+
+	/* parity of an erased step, inverted, so that it reads back as 0xff */
+	erased = malloc(step);
+	if (erased == NULL)
+		goto free_and_out;
+
+	memset(erased, 0xff, step);
+	nand_bch_encode(bch, erased, bch->eccmask);
+	for (i = 0; i < bch->ecc_bytes; i++)
+		bch->eccmask[i] ^= 0xff;
+	free(erased);
+
+	return bch;
+
+free_and_out:
+	nand_bch_free(bch);
+	return NULL;
+}
+
+void
+nand_bch_free (struct nand_bch *bch)
+{
+	if (bch == NULL)
+		return;
+
+	free(bch->mod_tab);
+	free(bch->a_log);
+	free(bch->a_pow);
+	free(bch);
+}
+
+unsigned
+nand_bch_bytes (const struct nand_bch *bch)
+{
+	return bch->ecc_bytes;
+}
+
+void
+nand_bch_encode (const struct nand_bch *bch,
+		 const unsigned char *data, unsigned char *ecc)
+{
+	unsigned i, len, l = bch->ecc_words;
+	uint32_t w, r[NAND_BCH_MAX_WORDS + 1] = {0};
+	const uint32_t *t0 = bch->mod_tab;
+	const uint32_t *t1 = t0 + 256 * l;
+	const uint32_t *t2 = t1 + 256 * l;
+	const uint32_t *t3 = t2 + 256 * l;
+	const uint32_t *p0, *p1, *p2, *p3;
+
+	/* r[l] stays zero, it is shifted into the last word */
+	for (len = bch->step; len >= 4; len -= 4, data += 4) {
+		w = r[0] ^ (((uint32_t)data[0] << 24) | (data[1] << 16) |
+			    (data[2] << 8) | data[3]);
+
+		p0 = t0 + (w & 0xff) * l;
+		p1 = t1 + ((w >> 8) & 0xff) * l;
+		p2 = t2 + ((w >> 16) & 0xff) * l;
+		p3 = t3 + (w >> 24) * l;
+
+		for (i = 0; i < l; i++)
+			r[i] = r[i + 1] ^ p0[i] ^ p1[i] ^ p2[i] ^ p3[i];
+	}
+
+	for (; len > 0; len--, data++) {
+		p0 = t0 + ((r[0] >> 24) ^ *data) * l;
+		for (i = 0; i < l; i++)
+			r[i] = ((r[i] << 8) | (r[i + 1] >> 24)) ^ p0[i];
+	}
+
+	for (i = 0; i < bch->ecc_bytes; i++)
+		ecc[i] = (r[i / 4] >> (24 - 8 * (i % 4))) ^ bch->eccmask[i];
+}
+
+int
+nand_bch_correct (const struct nand_bch *bch,
+		  unsigned char *data, unsigned char *ecc)
+{
+	unsigned i, j, p, len, nz = 0, roots = 0;
+	unsigned s[2 * NAND_BCH_MAX_T + 1], elp[NAND_BCH_MAX_T + 1];
+	unsigned loc[NAND_BCH_MAX_T];
+	int l, term[NAND_BCH_MAX_T + 1];
+	unsigned char diff[NAND_BCH_MAX_BYTES];
+
+	/* fast path: the syndromes are all zero iff the parity matches */
+	nand_bch_encode(bch, data, diff);
+	for (i = 0; i < bch->ecc_bytes; i++)
+		diff[i] ^= ecc[i];
+
+	/* the padding bits of the last parity byte do not count */
+	if (bch->ecc_bits % 8)
+		diff[bch->ecc_bits / 8] &= 0xff << (8 - bch->ecc_bits % 8);
+
+	for (i = 0; i < bch->ecc_bytes; i++)
+		nz |= diff[i];
+
+	if (nz == 0)
+		return 0;
+
+	nand_bch_syndromes(bch, diff, s);
+	l = nand_bch_berlekamp_massey(bch, s, elp);
+	if (l <= 0)
+		return -1;
+
+	/* Chien search: bit p of the codeword is in error iff elp(a^-p) = 0 */
+	for (i = 0; i <= l; i++)
+		term[i] = elp[i] ? bch->a_log[elp[i]] : -1;
+
+	len = bch->step * 8 + bch->ecc_bits;
+	for (p = 0; p < len && roots < (unsigned)l; p++) {
+		unsigned v = 0;
+
+		for (i = 0; i <= l; i++) {
+			if (term[i] < 0)
+				continue;
+			v ^= bch->a_pow[term[i]];
+			term[i] -= (int)i;
+			if (term[i] < 0)
+				term[i] += bch->n;
+		}
+
+		if (v == 0)
+			loc[roots++] = p;
+	}
+
+	if (roots != (unsigned)l)
+		return -1;
+
+	for (i = 0; i < roots; i++) {
+		p = loc[i];
+		if (p >= bch->ecc_bits) {
+			j = len - 1 - p;
+			data[j / 8] ^= 0x80 >> (j % 8);
+		}
+		else {
+			j = bch->ecc_bits - 1 - p;
+			ecc[j / 8] ^= 0x80 >> (j % 8);
+		}
+	}
+
+	return roots;
+}
@@ -0,0 +1,44 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_NAND_BCH_H__
+#define __YAFFS2UTILS_NAND_BCH_H__
+
+#define NAND_BCH_MAX_BYTES	64
+
+typedef struct nand_bch nand_bch_t;
+
+/*
+ * Binary BCH code over GF(2^m), with the parameters and the parity layout
+ * of the Linux lib/bch + nand_bch: m = fls(1 + 8 * step), t bits corrected
+ * per step, parity stored msb first and masked so that erased (0xff) data
+ * carries 0xff parity.
+ */
+struct nand_bch *nand_bch_init (unsigned step, unsigned strength);
+void nand_bch_free (struct nand_bch *bch);
+
+unsigned nand_bch_bytes (const struct nand_bch *bch);
+
+void nand_bch_encode (const struct nand_bch *bch,
+		      const unsigned char *data, unsigned char *ecc);
+
+/* bits corrected in data/ecc, or -1 when the step is uncorrectable */
+int nand_bch_correct (const struct nand_bch *bch,
+		      unsigned char *data, unsigned char *ecc);
+
+#endif
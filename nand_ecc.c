@@ -0,0 +1,732 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Word/vector kernels of the SmartMedia Hamming code in yaffs_ecc.c.
+ *
+ * The code is linear, so the column parity of a block is the column parity
+ * of the XOR of all its bytes, and bit k of the line parity is the parity
+ * of all bytes whose index has bit k set. The kernels below XOR the block
+ * down into one row plus one accumulator per row-index bit; the low index
+ * bits are then resolved on the folded row.
+ */
+
+#include "configs.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define _HAVE_X86_SIMD		1
+#endif
+#ifdef _HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+#include "yaffs_ecc.h"
+
+#include "nand_ecc.h"
+#include "nand_bch.h"
+
+/*----------------------------------------------------------------------------*/
+
+typedef struct nand_ecc_kernel {
+	const char *name;
+	int (*supported) (void);
+	void (*calc) (const unsigned char *, unsigned char *);
+} nand_ecc_kernel_t;
+
+static void nand_ecc_calc_table (const unsigned char *data,
+				 unsigned char *ecc);
+
+/* yaffs_ecc_calc() until a kernel is resolved by nand_ecc_setup() */
+static void
+(*nand_ecc_calc_fn) (const unsigned char *, unsigned char *) =
+	nand_ecc_calc_table;
+
+static const char *nand_ecc_kernel_name = NULL;
+
+static pthread_once_t nand_ecc_kernel_once = PTHREAD_ONCE_INIT;
+
+/*----------------------------------------------------------------------------*/
+
+static inline unsigned
+nand_ecc_parity64 (uint64_t x)
+{
+	return __builtin_parityll(x);
+}
+
+/*
+ * x: the block folded down to 'width' bytes,
+ * lp: line parity bits above log2(width), already resolved by the caller.
+ */
+static inline void
+nand_ecc_finish (const unsigned char *x, unsigned width, unsigned lp,
+		 unsigned char *ecc)
+{
+	unsigned i, m, t = 0, lpp, col;
+
+	for (i = 0; i < width; i++) {
+		t ^= x[i];
+		if (__builtin_parity(x[i]))
+			lp ^= i;
+	}
+
+	lpp = __builtin_parity(t) ? lp ^ 0xff : lp;
+
+	col = (__builtin_parity(t & 0xf0) << 7) |
+	      (__builtin_parity(t & 0x0f) << 6) |
+	      (__builtin_parity(t & 0xcc) << 5) |
+	      (__builtin_parity(t & 0x33) << 4) |
+	      (__builtin_parity(t & 0xaa) << 3) |
+	      (__builtin_parity(t & 0x55) << 2);
+
+	ecc[0] = ecc[1] = 0;
+	for (m = 0; m < 4; m++) {
+		ecc[0] |= (((lp >> m) & 1) << (2 * m + 1)) |
+			  (((lpp >> m) & 1) << (2 * m));
+		ecc[1] |= (((lp >> (m + 4)) & 1) << (2 * m + 1)) |
+			  (((lpp >> (m + 4)) & 1) << (2 * m));
+	}
+
+	ecc[0] = ~ecc[0];
+	ecc[1] = ~ecc[1];
+	ecc[2] = ~col | 0x03;
+}
+
+/*----------------------------------------------------------------------------*/
+
+static int
+nand_ecc_always (void)
+{
+	return 1;
+}
+
+static void
+nand_ecc_calc_table (const unsigned char *data, unsigned char *ecc)
+{
+	yaffs_ecc_calc(data, ecc);
+}
+
+/* 32 rows of 8 bytes, row index bits are line parity bits 3..7 */
+static void
+nand_ecc_calc_word (const unsigned char *data, unsigned char *ecc)
+{
+	unsigned i, k, lp = 0;
+	uint64_t w, x = 0, a[5] = {0};
+	unsigned char xb[8];
+
+	for (i = 0; i < 32; i++) {
+		memcpy(&w, data + i * 8, sizeof(w));
+		x ^= w;
+		for (k = 0; k < 5; k++)
+			a[k] ^= w & -(uint64_t)((i >> k) & 1);
+	}
+
+	for (k = 0; k < 5; k++)
+		lp |= nand_ecc_parity64(a[k]) << (k + 3);
+
+	memcpy(xb, &x, sizeof(xb));
+	nand_ecc_finish(xb, 8, lp, ecc);
+}
+
+#ifdef _HAVE_X86_SIMD
+static inline uint64_t
+nand_ecc_fold128 (__m128i v)
+{
+	uint64_t q[2];
+
+	_mm_storeu_si128((__m128i *)q, v);
+	return q[0] ^ q[1];
+}
+
+static int
+nand_ecc_has_sse2 (void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+/* 16 rows of 16 bytes, row index bits are line parity bits 4..7 */
+__attribute__((target("sse2")))
+static void
+nand_ecc_calc_sse2 (const unsigned char *data, unsigned char *ecc)
+{
+	unsigned i, lp = 0;
+	__m128i v, x, a0, a1, a2, a3, zero = _mm_setzero_si128();
+	unsigned char xb[16];
+
+	x = a0 = a1 = a2 = a3 = zero;
+	for (i = 0; i < 16; i++) {
+		v = _mm_loadu_si128((const __m128i *)(data + i * 16));
+		x = _mm_xor_si128(x, v);
+		a0 = _mm_xor_si128(a0, (i & 1) ? v : zero);
+		a1 = _mm_xor_si128(a1, (i & 2) ? v : zero);
+		a2 = _mm_xor_si128(a2, (i & 4) ? v : zero);
+		a3 = _mm_xor_si128(a3, (i & 8) ? v : zero);
+	}
+
+	lp |= nand_ecc_parity64(nand_ecc_fold128(a0)) << 4;
+	lp |= nand_ecc_parity64(nand_ecc_fold128(a1)) << 5;
+	lp |= nand_ecc_parity64(nand_ecc_fold128(a2)) << 6;
+	lp |= nand_ecc_parity64(nand_ecc_fold128(a3)) << 7;
+
+	_mm_storeu_si128((__m128i *)xb, x);
+	nand_ecc_finish(xb, 16, lp, ecc);
+}
+
+static int
+nand_ecc_has_avx2 (void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+/* 8 rows of 32 bytes, row index bits are line parity bits 5..7 */
+__attribute__((target("avx2")))
+static void
+nand_ecc_calc_avx2 (const unsigned char *data, unsigned char *ecc)
+{
+	unsigned i, lp = 0;
+	__m256i v, x, a0, a1, a2, zero = _mm256_setzero_si256();
+	uint64_t q[4];
+	unsigned char xb[32];
+
+	x = a0 = a1 = a2 = zero;
+	for (i = 0; i < 8; i++) {
+		v = _mm256_loadu_si256((const __m256i *)(data + i * 32));
+		x = _mm256_xor_si256(x, v);
+		a0 = _mm256_xor_si256(a0, (i & 1) ? v : zero);
+		a1 = _mm256_xor_si256(a1, (i & 2) ? v : zero);
+		a2 = _mm256_xor_si256(a2, (i & 4) ? v : zero);
+	}
+
+	_mm256_storeu_si256((__m256i *)q, a0);
+	lp |= nand_ecc_parity64(q[0] ^ q[1] ^ q[2] ^ q[3]) << 5;
+	_mm256_storeu_si256((__m256i *)q, a1);
+	lp |= nand_ecc_parity64(q[0] ^ q[1] ^ q[2] ^ q[3]) << 6;
+	_mm256_storeu_si256((__m256i *)q, a2);
+	lp |= nand_ecc_parity64(q[0] ^ q[1] ^ q[2] ^ q[3]) << 7;
+
+	_mm256_storeu_si256((__m256i *)xb, x);
+	nand_ecc_finish(xb, 32, lp, ecc);
+}
+#endif
+
+#ifdef _HAVE_NEON
+static inline uint64_t
+nand_ecc_fold_neon (uint8x16_t v)
+{
+	uint64x2_t q = vreinterpretq_u64_u8(v);
+
+	return vgetq_lane_u64(q, 0) ^ vgetq_lane_u64(q, 1);
+}
+
+/* 16 rows of 16 bytes, row index bits are line parity bits 4..7 */
+static void
+nand_ecc_calc_neon (const unsigned char *data, unsigned char *ecc)
+{
+	unsigned i, lp = 0;
+	uint8x16_t v, x, a0, a1, a2, a3, zero = vdupq_n_u8(0);
+	unsigned char xb[16];
+
+	x = a0 = a1 = a2 = a3 = zero;
+	for (i = 0; i < 16; i++) {
+		v = vld1q_u8(data + i * 16);
+		x = veorq_u8(x, v);
+		a0 = veorq_u8(a0, (i & 1) ? v : zero);
+		a1 = veorq_u8(a1, (i & 2) ? v : zero);
+		a2 = veorq_u8(a2, (i & 4) ? v : zero);
+		a3 = veorq_u8(a3, (i & 8) ? v : zero);
+	}
+
+	lp |= nand_ecc_parity64(nand_ecc_fold_neon(a0)) << 4;
+	lp |= nand_ecc_parity64(nand_ecc_fold_neon(a1)) << 5;
+	lp |= nand_ecc_parity64(nand_ecc_fold_neon(a2)) << 6;
+	lp |= nand_ecc_parity64(nand_ecc_fold_neon(a3)) << 7;
+
+	vst1q_u8(xb, x);
+	nand_ecc_finish(xb, 16, lp, ecc);
+}
+#endif
+
+/*----------------------------------------------------------------------------*/
+
+/* the preferred kernel comes first */
+static const struct nand_ecc_kernel nand_ecc_kernels[] = {
+#ifdef _HAVE_X86_SIMD
+	{"avx2",	nand_ecc_has_avx2,	nand_ecc_calc_avx2},
+	{"sse2",	nand_ecc_has_sse2,	nand_ecc_calc_sse2},
+#endif
+#ifdef _HAVE_NEON
+	{"neon",	nand_ecc_always,	nand_ecc_calc_neon},
+#endif
+	{"word",	nand_ecc_always,	nand_ecc_calc_word},
+	{"table",	nand_ecc_always,	nand_ecc_calc_table},
+	{NULL,		NULL,			NULL},
+};
+
+int
+nand_ecc_select (const char *name)
+{
+	const struct nand_ecc_kernel *k;
+
+	for (k = nand_ecc_kernels; k->name != NULL; k++) {
+		if (name != NULL && strcmp(name, k->name))
+			continue;
+
+		if (k->supported()) {
+			nand_ecc_kernel_name = k->name;
+			nand_ecc_calc_fn = k->calc;
+			return 0;
+		}
+
+		if (name != NULL)
+			break;
+	}
+
+	return -1;
+}
+
+/* the preferred kernel, unless one was selected already */
+static void
+nand_ecc_resolve (void)
+{
+	if (nand_ecc_kernel_name == NULL)
+		nand_ecc_select(NULL);
+}
+
+const char *
+nand_ecc_name (void)
+{
+	pthread_once(&nand_ecc_kernel_once, nand_ecc_resolve);
+
+	return nand_ecc_kernel_name;
+}
+
+void
+nand_ecc_calc (const unsigned char *data, unsigned char *ecc)
+{
+	nand_ecc_calc_fn(data, ecc);
+}
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * yaffs_ecc_calc_other() of the 16-byte tags part, two 64-bit words at a
+ * time: bit k of the line parity is the parity of all bytes whose index
+ * has bit k set, i.e. of the words under a fixed byte mask.
+ */
+
+static inline uint64_t
+nand_ecc_load_le64 (const unsigned char *p)
+{
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+	       ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+	       ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+	       ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static inline __attribute__((always_inline)) void
+nand_ecc_tags_one (const unsigned char *p, struct yaffs_ecc_other *ecc)
+{
+	uint64_t w0 = nand_ecc_load_le64(p);
+	uint64_t w1 = nand_ecc_load_le64(p + 8);
+	uint64_t x = w0 ^ w1;
+	unsigned lp, t;
+
+	lp = (__builtin_parityll(x & 0xff00ff00ff00ff00ULL)) |
+	     (__builtin_parityll(x & 0xffff0000ffff0000ULL) << 1) |
+	     (__builtin_parityll(x & 0xffffffff00000000ULL) << 2) |
+	     (__builtin_parityll(w1) << 3);
+
+	x ^= x >> 32;
+	x ^= x >> 16;
+	x ^= x >> 8;
+	t = x & 0xff;
+
+	ecc->col_parity = (__builtin_parity(t & 0xf0) << 5) |
+			  (__builtin_parity(t & 0x0f) << 4) |
+			  (__builtin_parity(t & 0xcc) << 3) |
+			  (__builtin_parity(t & 0x33) << 2) |
+			  (__builtin_parity(t & 0xaa) << 1) |
+			  (__builtin_parity(t & 0x55));
+	ecc->line_parity = lp;
+	ecc->line_parity_prime = __builtin_parity(t) ? ~lp : lp;
+}
+
+static void
+nand_ecc_calc_tags_word (const unsigned char *tags, size_t stride,
+			 unsigned n, struct yaffs_ecc_other *ecc)
+{
+	for (; n > 0; n--, tags += stride)
+		nand_ecc_tags_one(tags, ecc++);
+}
+
+#ifdef _HAVE_X86_SIMD
+static __attribute__((target("popcnt"))) void
+nand_ecc_calc_tags_popcnt (const unsigned char *tags, size_t stride,
+			   unsigned n, struct yaffs_ecc_other *ecc)
+{
+	for (; n > 0; n--, tags += stride)
+		nand_ecc_tags_one(tags, ecc++);
+}
+#endif
+
+void
+nand_ecc_calc_tags (const unsigned char *tags, size_t stride,
+		    unsigned n, struct yaffs_ecc_other *ecc)
+{
+#ifdef _HAVE_X86_SIMD
+	if (__builtin_cpu_supports("popcnt")) {
+		nand_ecc_calc_tags_popcnt(tags, stride, n, ecc);
+		return;
+	}
+#endif
+	nand_ecc_calc_tags_word(tags, stride, n, ecc);
+}
+
+/*----------------------------------------------------------------------------*/
+
+static int
+nand_ecc_in_oobfree (const nand_ecclayout_t *layout, unsigned pos)
+{
+	unsigned i;
+
+	for (i = 0; i < MTD_MAX_OOBFREE_ENTRIES; i++) {
+		if (pos >= layout->oobfree[i].offset &&
+		    pos < layout->oobfree[i].offset + layout->oobfree[i].length)
+			return 1;
+	}
+
+	return 0;
+}
+
+int
+nand_ecc_setup (struct nand_ecc_ctrl *ctrl, unsigned mode,
+		unsigned step, unsigned strength,
+		unsigned pagesize, unsigned sparesize,
+		const nand_ecclayout_t *oob)
+{
+	unsigned i, total;
+	nand_ecclayout_t *layout = &ctrl->layout;
+
+	/* before any worker of the caller calls nand_ecc_calc() */
+	pthread_once(&nand_ecc_kernel_once, nand_ecc_resolve);
+
+	memset(ctrl, 0, sizeof(struct nand_ecc_ctrl));
+	ctrl->mode = mode;
+	memcpy(layout, oob, sizeof(nand_ecclayout_t));
+
+	switch (mode) {
+	case NAND_ECC_NONE:
+		return 0;
+	case NAND_ECC_HAMMING:
+		ctrl->step = NAND_ECC_HAMMING_STEP;
+		ctrl->bytes = NAND_ECC_HAMMING_BYTES;
+		ctrl->strength = 1;
+		break;
+	case NAND_ECC_BCH:
+		ctrl->step = step ? step : NAND_ECC_BCH_STEP;
+		ctrl->strength = strength ? strength : NAND_ECC_BCH_STRENGTH;
+		ctrl->bch = nand_bch_init(ctrl->step, ctrl->strength);
+		if (ctrl->bch == NULL)
+			goto release_and_out;
+		ctrl->bytes = nand_bch_bytes(ctrl->bch);
+		break;
+	default:
+		return -1;
+	}
+
+	if (pagesize % ctrl->step)
+		goto release_and_out;
+
+	ctrl->steps = pagesize / ctrl->step;
+	total = ctrl->steps * ctrl->bytes;
+	if (total > sparesize)
+		goto release_and_out;
+
+	ctrl->pos = malloc(total * sizeof(unsigned));
+	if (ctrl->pos == NULL)
+		goto release_and_out;
+
+	/*
+	 * take the eccpos of the layout when they are exactly the ECC
+	 * bytes, or else the tail of the spare (as nand_bch_init does,
+	 * which rejects an eccpos of another size).
+	 */
+	if (total != layout->eccbytes) {
+		if (layout->oobfree[0].offset + total > sparesize)
+			goto release_and_out;
+
+		layout->oobfree[0].length = sparesize - total -
+					    layout->oobfree[0].offset;
+		for (i = 1; i < MTD_MAX_OOBFREE_ENTRIES; i++) {
+			layout->oobfree[i].offset = 0;
+			layout->oobfree[i].length = 0;
+		}
+	}
+
+	for (i = 0; i < total; i++) {
+		ctrl->pos[i] = total == layout->eccbytes ?
+			       layout->eccpos[i] : sparesize - total + i;
+
+		if (ctrl->pos[i] >= sparesize ||
+		    nand_ecc_in_oobfree(layout, ctrl->pos[i]))
+			goto release_and_out;
+	}
+
+	return 0;
+
+release_and_out:
+	nand_ecc_release(ctrl);
+	return -1;
+}
+
+void
+nand_ecc_release (struct nand_ecc_ctrl *ctrl)
+{
+	nand_bch_free(ctrl->bch);
+	free(ctrl->pos);
+	ctrl->bch = NULL;
+	ctrl->pos = NULL;
+	ctrl->mode = NAND_ECC_NONE;
+}
+
+static int
+nand_ecc_syndrome_pos (const struct nand_ecc_ctrl *ctrl, unsigned pos)
+{
+	unsigned chunk = ctrl->prepad + ctrl->bytes + ctrl->postpad;
+
+	return pos < ctrl->steps * chunk && pos % chunk >= ctrl->prepad &&
+	       pos % chunk < ctrl->prepad + ctrl->bytes;
+}
+
+int
+nand_ecc_syndrome (struct nand_ecc_ctrl *ctrl, unsigned prepad,
+		   unsigned postpad, unsigned sparesize,
+		   nand_ecclayout_t *layout)
+{
+	unsigned i, j, n, pos, chunk;
+	unsigned maxpos = sizeof(layout->eccpos) / sizeof(layout->eccpos[0]);
+
+	if (ctrl->mode == NAND_ECC_NONE)
+		return -1;
+
+	chunk = prepad + ctrl->bytes + postpad;
+	if (ctrl->steps * chunk > sparesize)
+		return -1;
+
+	ctrl->syndrome = 1;
+	ctrl->prepad = prepad;
+	ctrl->postpad = postpad;
+	ctrl->oobsize = sparesize;
+
+	memset(layout, 0, sizeof(nand_ecclayout_t));
+
+	for (i = 0, n = 0; i < ctrl->steps; i++) {
+		for (j = 0; j < ctrl->bytes; j++, n++) {
+			ctrl->pos[n] = i * chunk + prepad + j;
+			if (n < maxpos)
+				layout->eccpos[n] = ctrl->pos[n];
+		}
+	}
+	layout->eccbytes = n < maxpos ? n : maxpos;
+
+	/* the runs of free bytes, the bad block marker left alone */
+	pos = sparesize > 16 ? 2 : 0;
+	for (i = 0; i < MTD_MAX_OOBFREE_ENTRIES && pos < sparesize; i++) {
+		while (pos < sparesize && nand_ecc_syndrome_pos(ctrl, pos))
+			pos++;
+
+		layout->oobfree[i].offset = pos;
+		while (pos < sparesize && !nand_ecc_syndrome_pos(ctrl, pos))
+			pos++;
+
+		layout->oobfree[i].length = pos - layout->oobfree[i].offset;
+		layout->oobavail += layout->oobfree[i].length;
+	}
+
+	return 0;
+}
+
+void
+nand_ecc_interleave (const struct nand_ecc_ctrl *ctrl,
+		     const unsigned char *data, const unsigned char *spare,
+		     unsigned char *page)
+{
+	unsigned i, chunk = ctrl->prepad + ctrl->bytes + ctrl->postpad;
+
+	for (i = 0; i < ctrl->steps; i++) {
+		memcpy(page, data, ctrl->step);
+		page += ctrl->step;
+		data += ctrl->step;
+
+		memcpy(page, spare, chunk);
+		page += chunk;
+		spare += chunk;
+	}
+
+	memcpy(page, spare, ctrl->oobsize - ctrl->steps * chunk);
+}
+
+void
+nand_ecc_deinterleave (const struct nand_ecc_ctrl *ctrl,
+		       const unsigned char *page,
+		       unsigned char *data, unsigned char *spare)
+{
+	unsigned i, chunk = ctrl->prepad + ctrl->bytes + ctrl->postpad;
+
+	for (i = 0; i < ctrl->steps; i++) {
+		memcpy(data, page, ctrl->step);
+		page += ctrl->step;
+		data += ctrl->step;
+
+		memcpy(spare, page, chunk);
+		page += chunk;
+		spare += chunk;
+	}
+
+	memcpy(spare, page, ctrl->oobsize - ctrl->steps * chunk);
+}
+
+void
+nand_ecc_encode (const struct nand_ecc_ctrl *ctrl,
+		 const unsigned char *data, unsigned char *spare)
+{
+	unsigned i, j;
+	unsigned char ecc[NAND_BCH_MAX_BYTES];
+	const unsigned *pos = ctrl->pos;
+
+	switch (ctrl->mode) {
+	case NAND_ECC_HAMMING:
+		for (i = 0; i < ctrl->steps; i++, data += ctrl->step) {
+			nand_ecc_calc(data, ecc);
+
+			/* Linux MTD swaps the line parity bytes (non-SMC) */
+			spare[*pos++] = ecc[1];
+			spare[*pos++] = ecc[0];
+			spare[*pos++] = ecc[2];
+		}
+		break;
+	case NAND_ECC_BCH:
+		for (i = 0; i < ctrl->steps; i++, data += ctrl->step) {
+			nand_bch_encode(ctrl->bch, data, ecc);
+			for (j = 0; j < ctrl->bytes; j++)
+				spare[*pos++] = ecc[j];
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * A step that fails to decode may be an erased one with a few bitflips,
+ * which is cleaned up when it has no more zero bits than the strength.
+ */
+static int
+nand_ecc_erased (unsigned char *data, unsigned len,
+		 unsigned char *ecc, unsigned bytes, unsigned strength)
+{
+	unsigned i, flips = 0;
+
+	for (i = 0; i < len && flips <= strength; i++)
+		flips += 8 - __builtin_popcount(data[i]);
+	for (i = 0; i < bytes && flips <= strength; i++)
+		flips += 8 - __builtin_popcount(ecc[i]);
+
+	if (flips > strength)
+		return -1;
+
+	memset(data, 0xff, len);
+	memset(ecc, 0xff, bytes);
+
+	return flips;
+}
+
+static int
+nand_ecc_correct_hamming (unsigned char *data, unsigned char *ecc)
+{
+	int r;
+	unsigned char calc[NAND_ECC_HAMMING_BYTES];
+	unsigned char read[NAND_ECC_HAMMING_BYTES] = {ecc[1], ecc[0], ecc[2]};
+
+	nand_ecc_calc(data, calc);
+	if (!memcmp(read, calc, NAND_ECC_HAMMING_BYTES))
+		return 0;
+
+	r = yaffs_ecc_correct(data, read, calc);
+	if (r > 0) {
+		/* the flip may be in the ecc itself, store the right one */
+		nand_ecc_calc(data, calc);
+		ecc[0] = calc[1];
+		ecc[1] = calc[0];
+		ecc[2] = calc[2];
+	}
+
+	return r;
+}
+
+int
+nand_ecc_correct (const struct nand_ecc_ctrl *ctrl,
+		  unsigned char *data, unsigned char *spare)
+{
+	unsigned i, j;
+	int r, bits = 0, failed = 0;
+	unsigned char ecc[NAND_BCH_MAX_BYTES];
+	const unsigned *pos;
+
+	for (i = 0; i < ctrl->steps; i++, data += ctrl->step) {
+		pos = ctrl->pos + i * ctrl->bytes;
+		for (j = 0; j < ctrl->bytes; j++)
+			ecc[j] = spare[pos[j]];
+
+		switch (ctrl->mode) {
+		case NAND_ECC_HAMMING:
+			r = nand_ecc_correct_hamming(data, ecc);
+			break;
+		case NAND_ECC_BCH:
+			r = nand_bch_correct(ctrl->bch, data, ecc);
+			break;
+		default:
+			r = 0;
+			break;
+		}
+
+		if (r < 0)
+			r = nand_ecc_erased(data, ctrl->step, ecc, ctrl->bytes,
+					    ctrl->strength);
+
+		if (r < 0) {
+			failed = 1;
+			continue;
+		}
+
+		if (r > 0) {
+			for (j = 0; j < ctrl->bytes; j++)
+				spare[pos[j]] = ecc[j];
+			bits += r;
+		}
+	}
+
+	return failed ? -1 : bits;
+}
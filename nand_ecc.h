@@ -0,0 +1,117 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_NAND_ECC_H__
+#define __YAFFS2UTILS_NAND_ECC_H__
+
+#include <stddef.h>
+
+#ifndef _HAVE_BROKEN_MTD_H
+#include <mtd/mtd-user.h>
+#else
+#include "mtd-abi.h"
+#endif
+
+#define NAND_ECC_HAMMING_STEP	256
+#define NAND_ECC_HAMMING_BYTES	3
+
+#define NAND_ECC_NONE		0
+#define NAND_ECC_HAMMING	1
+#define NAND_ECC_BCH		2
+
+#define NAND_ECC_BCH_STEP	512
+#define NAND_ECC_BCH_STRENGTH	4
+
+/* software ECC of the data area, placed in the spare like Linux MTD does */
+typedef struct nand_ecc_ctrl {
+	unsigned mode;
+	unsigned step;			/* data bytes per ECC step */
+	unsigned bytes;			/* ECC bytes per step */
+	unsigned steps;			/* ECC steps per page */
+	unsigned strength;		/* bits corrected per step */
+	unsigned *pos;			/* spare offset of every ECC byte */
+	struct nand_bch *bch;
+	nand_ecclayout_t layout;	/* the oobfree left to the tags */
+
+	int syndrome;			/* ECC interleaved with the data */
+	unsigned prepad;		/* spare bytes before every ECC */
+	unsigned postpad;		/* and after it */
+	unsigned oobsize;
+} nand_ecc_ctrl_t;
+
+/*
+ * Hamming ECC over a 256-byte block, bit-exact with yaffs_ecc_calc().
+ * The fastest kernel supported by the running CPU is picked once, by the
+ * first nand_ecc_setup() (or nand_ecc_name()), unless nand_ecc_select()
+ * chose one before. Select or set up before starting threads that use it.
+ */
+void nand_ecc_calc (const unsigned char *data, unsigned char *ecc);
+
+int nand_ecc_select (const char *name);
+const char *nand_ecc_name (void);
+
+/*
+ * yaffs_ecc_calc_other() of n packed tags (the 16-byte tags part), laid
+ * 'stride' bytes apart, e.g. an array of struct yaffs_packed_tags2.
+ */
+struct yaffs_ecc_other;
+void nand_ecc_calc_tags (const unsigned char *tags, size_t stride,
+			 unsigned n, struct yaffs_ecc_other *ecc);
+
+/*
+ * 'oob' is copied to ctrl->layout. Unless its eccpos are exactly the ECC
+ * bytes of a page, the ECC goes to the tail of the spare and the oobfree
+ * of the copy is cut short, like nand_bch; the tags are then placed by
+ * ctrl->layout.
+ */
+int nand_ecc_setup (struct nand_ecc_ctrl *ctrl, unsigned mode,
+		    unsigned step, unsigned strength,
+		    unsigned pagesize, unsigned sparesize,
+		    const nand_ecclayout_t *oob);
+void nand_ecc_release (struct nand_ecc_ctrl *ctrl);
+
+/*
+ * The syndrome layout of NAND_ECC_HW_SYNDROME controllers: in the physical
+ * page, every step of data is followed by its own prepad, ECC and postpad,
+ * and the rest of the oob comes last. The spare buffer stays as the oob of
+ * Linux (chip->oob_poi): those per-step parts one after another, then the
+ * rest. The ECC moves there, and 'layout' gets every other byte as free.
+ */
+int nand_ecc_syndrome (struct nand_ecc_ctrl *ctrl, unsigned prepad,
+		       unsigned postpad, unsigned sparesize,
+		       nand_ecclayout_t *layout);
+
+/* the physical page from the data and the spare, and the way back */
+void nand_ecc_interleave (const struct nand_ecc_ctrl *ctrl,
+			  const unsigned char *data,
+			  const unsigned char *spare, unsigned char *page);
+void nand_ecc_deinterleave (const struct nand_ecc_ctrl *ctrl,
+			    const unsigned char *page,
+			    unsigned char *data, unsigned char *spare);
+
+void nand_ecc_encode (const struct nand_ecc_ctrl *ctrl,
+		      const unsigned char *data, unsigned char *spare);
+
+/*
+ * Correct the data (and the ECC) of a page in place. Returns the number of
+ * bits corrected, or -1 when some step is beyond repair.
+ */
+int nand_ecc_correct (const struct nand_ecc_ctrl *ctrl,
+		      unsigned char *data, unsigned char *spare);
+
+#endif
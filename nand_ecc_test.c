@@ -0,0 +1,147 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Differential test of the Hamming kernels in nand_ecc.c: every kernel
+ * compiled in and supported by the running CPU must give the same three
+ * ECC bytes as yaffs_ecc_calc() on random blocks, on every single-bit flip
+ * of a block, and on the erased (all 0xff) and all-zero blocks.
+ */
+
+#include "configs.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "yaffs_ecc.h"
+
+#include "nand_ecc.h"
+
+#define NAND_ECC_TEST_BLOCKS	4096
+#define NAND_ECC_TEST_FLIPS	16
+
+static const char *nand_ecc_test_kernels[] = {
+	"avx2", "sse2", "neon", "word", "table", NULL,
+};
+
+static uint64_t nand_ecc_test_state = 0x9e3779b97f4a7c15ULL;
+
+static unsigned
+nand_ecc_test_rand (void)
+{
+	uint64_t x = nand_ecc_test_state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	nand_ecc_test_state = x;
+
+	return (unsigned)(x >> 32);
+}
+
+static void
+nand_ecc_test_fill (unsigned char *block)
+{
+	unsigned i;
+
+	for (i = 0; i < NAND_ECC_HAMMING_STEP; i++)
+		block[i] = nand_ecc_test_rand() & 0xff;
+}
+
+static int
+nand_ecc_test_one (const char *kernel, const char *what, unsigned n,
+		   const unsigned char *block)
+{
+	unsigned char ref[NAND_ECC_HAMMING_BYTES], ecc[NAND_ECC_HAMMING_BYTES];
+
+	yaffs_ecc_calc(block, ref);
+	memset(ecc, 0, sizeof(ecc));
+	nand_ecc_calc(block, ecc);
+
+	if (memcmp(ref, ecc, sizeof(ecc))) {
+		fprintf(stderr, "%s: %s #%u: ecc %02x%02x%02x, "
+			"expected %02x%02x%02x\n", kernel, what, n,
+			ecc[0], ecc[1], ecc[2], ref[0], ref[1], ref[2]);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+nand_ecc_test_kernel (const char *kernel)
+{
+	unsigned i, j, bit, errs = 0;
+	unsigned char block[NAND_ECC_HAMMING_STEP];
+
+	for (i = 0; i < NAND_ECC_TEST_BLOCKS; i++) {
+		nand_ecc_test_fill(block);
+		errs += nand_ecc_test_one(kernel, "random", i, block) < 0;
+	}
+
+	for (i = 0; i < NAND_ECC_TEST_FLIPS; i++) {
+		nand_ecc_test_fill(block);
+		for (bit = 0; bit < NAND_ECC_HAMMING_STEP * 8; bit++) {
+			block[bit / 8] ^= 1 << (bit % 8);
+			j = i * NAND_ECC_HAMMING_STEP * 8 + bit;
+			errs += nand_ecc_test_one(kernel, "bitflip", j,
+						  block) < 0;
+			block[bit / 8] ^= 1 << (bit % 8);
+		}
+	}
+
+	memset(block, 0xff, sizeof(block));
+	errs += nand_ecc_test_one(kernel, "erased", 0, block) < 0;
+	for (bit = 0; bit < NAND_ECC_HAMMING_STEP * 8; bit++) {
+		block[bit / 8] ^= 1 << (bit % 8);
+		errs += nand_ecc_test_one(kernel, "erased bitflip", bit,
+					  block) < 0;
+		block[bit / 8] ^= 1 << (bit % 8);
+	}
+
+	memset(block, 0, sizeof(block));
+	errs += nand_ecc_test_one(kernel, "zero", 0, block) < 0;
+
+	return errs ? -1 : 0;
+}
+
+int
+main (void)
+{
+	int retval = 0;
+	const char **k;
+
+	for (k = nand_ecc_test_kernels; *k != NULL; k++) {
+		if (nand_ecc_select(*k) < 0) {
+			printf("nand_ecc %-6s skipped\n", *k);
+			continue;
+		}
+
+		if (strcmp(nand_ecc_name(), *k) ||
+		    nand_ecc_test_kernel(*k) < 0) {
+			printf("nand_ecc %-6s FAILED\n", *k);
+			retval = 1;
+			continue;
+		}
+
+		printf("nand_ecc %-6s ok\n", *k);
+	}
+
+	return retval;
+}
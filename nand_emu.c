@@ -0,0 +1,515 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "configs.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "nand_emu.h"
+
+/*----------------------------------------------------------------------------*/
+
+static off_t
+nand_emu_offset (const struct nand_emu *emu, unsigned block)
+{
+	return (off_t)block * emu->blocksize;
+}
+
+/* where the factory marks a bad block, as nand_block_bad() looks */
+static off_t
+nand_emu_marker (const struct nand_emu *emu, unsigned block)
+{
+	return nand_emu_offset(emu, block) + emu->writesize +
+	       (emu->writesize == 512 ? 5 : 0);
+}
+
+static void
+nand_emu_delay (unsigned long long us)
+{
+	struct timespec ts;
+
+	if (us == 0)
+		return;
+
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = us % 1000000 * 1000;
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+static int
+nand_emu_listed (const unsigned *list, unsigned n, unsigned block)
+{
+	while (n--)
+		if (list[n] == block)
+			return 1;
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
+static int
+nand_emu_number (const char *s, unsigned *value)
+{
+	char *end;
+	unsigned long n;
+
+	errno = 0;
+	n = strtoul(s, &end, 0);
+	if (errno || end == s || *end != '\0' || n > (unsigned)-1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*value = n;
+	return 0;
+}
+
+/* blocks separated by colons */
+static int
+nand_emu_list (char *s, unsigned **list, unsigned *n)
+{
+	char *next;
+	unsigned *l;
+
+	while ((next = strsep(&s, ":")) != NULL) {
+		l = realloc(*list, (*n + 1) * sizeof(unsigned));
+		if (l == NULL)
+			return -1;
+		*list = l;
+
+		if (nand_emu_number(next, &l[*n]) < 0)
+			return -1;
+		(*n)++;
+	}
+
+	return 0;
+}
+
+static int
+nand_emu_options (struct nand_emu *emu, char *opts, unsigned *blocks)
+{
+	char *opt, *value;
+	unsigned *n;
+
+	while ((opt = strsep(&opts, ",")) != NULL) {
+		value = strchr(opt, '=');
+		if (value == NULL) {
+			errno = EINVAL;
+			return -1;
+		}
+		*value++ = '\0';
+
+		if (!strcmp(opt, "bad")) {
+			if (nand_emu_list(value, &emu->bad, &emu->nbad) < 0)
+				return -1;
+			continue;
+		}
+		if (!strcmp(opt, "worn")) {
+			if (nand_emu_list(value, &emu->worn, &emu->nworn) < 0)
+				return -1;
+			continue;
+		}
+
+		if (!strcmp(opt, "writesize"))
+			n = &emu->writesize;
+		else if (!strcmp(opt, "oobsize"))
+			n = &emu->oobsize;
+		else if (!strcmp(opt, "ppb"))
+			n = &emu->pages_per_block;
+		else if (!strcmp(opt, "blocks"))
+			n = blocks;
+		else if (!strcmp(opt, "flips"))
+			n = &emu->flips;
+		else if (!strcmp(opt, "strength"))
+			n = &emu->strength;
+		else if (!strcmp(opt, "seed"))
+			n = &emu->seed;
+		else if (!strcmp(opt, "tread"))
+			n = &emu->tread;
+		else if (!strcmp(opt, "tprog"))
+			n = &emu->tprog;
+		else if (!strcmp(opt, "terase"))
+			n = &emu->terase;
+		else {
+			errno = EINVAL;
+			return -1;
+		}
+
+		if (nand_emu_number(value, n) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+nand_emu_create (struct nand_emu *emu, unsigned blocks)
+{
+	unsigned i;
+
+	for (i = 0; i < blocks; i++) {
+		if (pwrite(emu->fd, emu->erased, emu->blocksize,
+			   nand_emu_offset(emu, i)) != emu->blocksize)
+			return -1;
+	}
+
+	return 0;
+}
+
+int
+nand_emu_open (struct nand_emu *emu, const char *spec, unsigned writesize,
+	       unsigned oobsize, unsigned pages_per_block)
+{
+	char *path, *opts;
+	unsigned i, blocks = 0;
+	struct stat statbuf;
+	int created = 0, retval = -1;
+
+	memset(emu, 0, sizeof(*emu));
+	emu->fd = -1;
+	emu->writesize = writesize;
+	emu->oobsize = oobsize;
+	emu->pages_per_block = pages_per_block;
+	emu->strength = NAND_EMU_STRENGTH;
+	emu->seed = 1;
+
+	path = strdup(spec);
+	if (path == NULL)
+		return -1;
+
+	opts = strchr(path, ',');
+	if (opts != NULL)
+		*opts++ = '\0';
+	if (nand_emu_options(emu, opts, &blocks) < 0)
+		goto out;
+
+	if (!emu->writesize || !emu->oobsize || !emu->pages_per_block) {
+		errno = EINVAL;
+		goto out;
+	}
+	emu->blocksize = (size_t)emu->pages_per_block *
+			 (emu->writesize + emu->oobsize);
+
+	emu->fd = open(path, O_RDWR | (blocks ? O_CREAT : 0), 0644);
+	if (emu->fd < 0 || fstat(emu->fd, &statbuf) < 0)
+		goto out;
+
+	if (!S_ISREG(statbuf.st_mode)) {
+		errno = ENODEV;
+		goto out;
+	}
+
+	emu->erased = malloc(emu->blocksize);
+	emu->buf = malloc(emu->blocksize);
+	if (emu->erased == NULL || emu->buf == NULL)
+		goto out;
+	memset(emu->erased, 0xff, emu->blocksize);
+
+	if (statbuf.st_size == 0 && blocks) {
+		if (nand_emu_create(emu, blocks) < 0)
+			goto out;
+		statbuf.st_size = (off_t)blocks * emu->blocksize;
+		created = 1;
+	}
+
+	if (statbuf.st_size == 0 || statbuf.st_size % emu->blocksize ||
+	    (blocks && statbuf.st_size / emu->blocksize != blocks)) {
+		errno = EINVAL;
+		goto out;
+	}
+	emu->blocks = statbuf.st_size / emu->blocksize;
+
+	/* all erased when it was just made */
+	emu->clean = malloc(emu->blocks);
+	if (emu->clean == NULL)
+		goto out;
+	memset(emu->clean, created, emu->blocks);
+
+	for (i = 0; i < emu->nbad; i++) {
+		if (emu->bad[i] >= emu->blocks) {
+			errno = EINVAL;
+			goto out;
+		}
+		if (nand_emu_markbad(emu, emu->bad[i]) < 0)
+			goto out;
+	}
+	for (i = 0; i < emu->nworn; i++) {
+		if (emu->worn[i] >= emu->blocks) {
+			errno = EINVAL;
+			goto out;
+		}
+	}
+
+	retval = 0;
+out:
+	free(path);
+	if (retval < 0)
+		nand_emu_close(emu);
+
+	return retval;
+}
+
+void
+nand_emu_close (struct nand_emu *emu)
+{
+	int err = errno;
+
+	if (emu->fd >= 0)
+		close(emu->fd);
+
+	free(emu->bad);
+	free(emu->worn);
+	free(emu->clean);
+	free(emu->erased);
+	free(emu->buf);
+	memset(emu, 0, sizeof(*emu));
+	emu->fd = -1;
+
+	errno = err;
+}
+
+/*----------------------------------------------------------------------------*/
+
+int
+nand_emu_isbad (struct nand_emu *emu, unsigned block)
+{
+	unsigned char marker;
+
+	if (block >= emu->blocks) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pread(emu->fd, &marker, 1, nand_emu_marker(emu, block)) != 1)
+		return -1;
+
+	return marker != 0xff;
+}
+
+int
+nand_emu_markbad (struct nand_emu *emu, unsigned block)
+{
+	unsigned char marker = 0;
+
+	if (block >= emu->blocks) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	emu->clean[block] = 0;
+	if (pwrite(emu->fd, &marker, 1, nand_emu_marker(emu, block)) != 1)
+		return -1;
+
+	return 0;
+}
+
+int
+nand_emu_erase (struct nand_emu *emu, unsigned block)
+{
+	int bad;
+
+	bad = nand_emu_isbad(emu, block);
+	if (bad < 0)
+		return -1;
+
+	nand_emu_delay(emu->terase);
+
+	/* nand_erase_nand() does not erase a bad block either */
+	if (bad || nand_emu_listed(emu->worn, emu->nworn, block)) {
+		errno = EIO;
+		return -1;
+	}
+
+	if (pwrite(emu->fd, emu->erased, emu->blocksize,
+		   nand_emu_offset(emu, block)) != emu->blocksize)
+		return -1;
+	emu->clean[block] = 1;
+
+	return 0;
+}
+
+/* a program only takes the bits from 1 to 0 */
+static void
+nand_emu_program (unsigned char *cell, const unsigned char *buf, size_t size,
+		  int clean)
+{
+	size_t i;
+
+	if (clean) {
+		memcpy(cell, buf, size);
+		return;
+	}
+
+	for (i = 0; i < size; i++)
+		cell[i] &= buf[i];
+}
+
+int
+nand_emu_write (struct nand_emu *emu, unsigned block,
+		const unsigned char *data, const unsigned char *oob,
+		unsigned pages)
+{
+	size_t size = (size_t)pages * (emu->writesize + emu->oobsize);
+	off_t offset = nand_emu_offset(emu, block);
+	int clean;
+	unsigned char *cell;
+	unsigned i;
+
+	if (block >= emu->blocks || pages > emu->pages_per_block) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	nand_emu_delay((unsigned long long)emu->tprog * pages);
+
+	if (nand_emu_listed(emu->worn, emu->nworn, block)) {
+		errno = EIO;
+		return -1;
+	}
+
+	clean = emu->clean[block];
+	if (!clean && pread(emu->fd, emu->buf, size, offset) != size)
+		return -1;
+
+	for (i = 0, cell = emu->buf; i < pages; i++) {
+		nand_emu_program(cell, data, emu->writesize, clean);
+		cell += emu->writesize;
+		nand_emu_program(cell, oob, emu->oobsize, clean);
+		cell += emu->oobsize;
+		data += emu->writesize;
+		oob += emu->oobsize;
+	}
+
+	emu->clean[block] = 0;
+	if (pwrite(emu->fd, emu->buf, size, offset) != size)
+		return -1;
+
+	return 0;
+}
+
+/* in the data, where the ecc of the software and of the driver covers */
+static void
+nand_emu_flip (struct nand_emu *emu, unsigned char *page, unsigned n)
+{
+	unsigned bit, bits = emu->writesize * 8;
+
+	while (n--) {
+		bit = (unsigned)rand_r(&emu->seed) % bits;
+		page[bit / 8] ^= 1 << (bit % 8);
+	}
+}
+
+int
+nand_emu_read (struct nand_emu *emu, unsigned block,
+	       unsigned char *data, unsigned char *oob,
+	       unsigned pages, int raw)
+{
+	size_t size = (size_t)pages * (emu->writesize + emu->oobsize);
+	int corrected = 0, failed = 0;
+	unsigned char *page;
+	unsigned i;
+
+	if (block >= emu->blocks || pages > emu->pages_per_block) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pread(emu->fd, emu->buf, size, nand_emu_offset(emu, block)) != size)
+		return -1;
+
+	for (i = 0, page = emu->buf; i < pages; i++) {
+		if (raw || emu->flips > emu->strength) {
+			nand_emu_flip(emu, page, emu->flips);
+			failed |= !raw && emu->flips;
+		} else {
+			corrected += emu->flips;
+		}
+
+		memcpy(data, page, emu->writesize);
+		data += emu->writesize;
+		page += emu->writesize;
+		if (oob != NULL) {
+			memcpy(oob, page, emu->oobsize);
+			oob += emu->oobsize;
+		}
+		page += emu->oobsize;
+	}
+
+	nand_emu_delay((unsigned long long)emu->tread * pages);
+
+	if (failed) {
+		errno = EBADMSG;
+		return -1;
+	}
+
+	return corrected;
+}
+
+/*----------------------------------------------------------------------------*/
+
+int
+nand_emu_ecclayout (const struct nand_emu *emu, nand_ecclayout_t *layout)
+{
+	unsigned i, eccbytes;
+
+	memset(layout, 0, sizeof(*layout));
+
+	/* nand_ooblayout_sp_ops and nand_ooblayout_lp_ops of Linux */
+	if (emu->oobsize == 8) {
+		eccbytes = 3;
+		layout->oobfree[0].offset = 3;
+		layout->oobfree[0].length = 2;
+		layout->oobfree[1].offset = 6;
+		layout->oobfree[1].length = 2;
+	} else if (emu->oobsize == 16) {
+		eccbytes = 6;
+		layout->oobfree[0].offset = 8;
+		layout->oobfree[0].length = 8;
+	} else {
+		eccbytes = emu->writesize / 256 * 3;
+		if (emu->oobsize < 64 || eccbytes + 2 > emu->oobsize ||
+		    eccbytes > sizeof(layout->eccpos) / sizeof(layout->eccpos[0])) {
+			errno = ENOTSUP;
+			return -1;
+		}
+		layout->oobfree[0].offset = 2;
+		layout->oobfree[0].length = emu->oobsize - eccbytes - 2;
+	}
+
+	layout->eccbytes = eccbytes;
+	for (i = 0; i < eccbytes; i++) {
+		if (emu->oobsize > 16)
+			layout->eccpos[i] = emu->oobsize - eccbytes + i;
+		else
+			layout->eccpos[i] = i < 4 || emu->oobsize == 8 ? i : i + 2;
+	}
+
+	for (i = 0; i < MTD_MAX_OOBFREE_ENTRIES &&
+		    layout->oobfree[i].length; i++)
+		layout->oobavail += layout->oobfree[i].length;
+
+	return 0;
+}
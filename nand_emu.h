@@ -0,0 +1,102 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_NAND_EMU_H__
+#define __YAFFS2UTILS_NAND_EMU_H__
+
+#include <stddef.h>
+
+#ifndef _HAVE_BROKEN_MTD_H
+#include <mtd/mtd-user.h>
+#else
+#include "mtd-abi.h"
+#endif
+
+#define NAND_EMU_STRENGTH	4	/* bits the emulated ecc corrects */
+
+/*
+ * A file emulating a raw NAND, for the tools to run against without the
+ * hardware. The file is a "nanddump --oob" dump, the data of every page
+ * followed by its oob, and a block is bad when the first oob byte of its
+ * first page (the sixth one for 512-byte pages) is not 0xff.
+ *
+ * Like the chip, an erase sets a block to 0xff and a program only clears
+ * bits. The emulation is set up by options following the path of the file
+ * and separated by commas, e.g. "nand.bin,ppb=64,bad=3:17,flips=2":
+ *
+ *   writesize=N, oobsize=N, ppb=N   the geometry, else that of the caller
+ *   blocks=N        create the file with N erased blocks if it is empty
+ *   bad=B:B:...     blocks marked bad by the factory
+ *   worn=B:B:...    blocks whose erase and program fail with EIO
+ *   flips=N         bits flipped at random in the data of every page read
+ *   strength=N      bits of a page the ecc of non-raw reads corrects
+ *   seed=N          of the bit flips
+ *   tread=us, tprog=us, terase=us
+ *                   the time to read and program a page, erase a block
+ */
+typedef struct nand_emu {
+	int fd;
+	unsigned writesize;
+	unsigned oobsize;
+	unsigned pages_per_block;
+	unsigned blocks;
+	size_t blocksize;		/* bytes of a block in the file */
+
+	unsigned *bad;
+	unsigned nbad;
+	unsigned *worn;
+	unsigned nworn;
+	unsigned flips;
+	unsigned strength;
+	unsigned seed;
+	unsigned tread;
+	unsigned tprog;
+	unsigned terase;
+
+	unsigned char *clean;		/* erased and not programmed since */
+	unsigned char *erased;		/* a block of 0xff */
+	unsigned char *buf;		/* a block in the file layout */
+} nand_emu_t;
+
+int nand_emu_open (struct nand_emu *emu, const char *spec, unsigned writesize,
+		   unsigned oobsize, unsigned pages_per_block);
+void nand_emu_close (struct nand_emu *emu);
+
+int nand_emu_isbad (struct nand_emu *emu, unsigned block);
+int nand_emu_markbad (struct nand_emu *emu, unsigned block);
+int nand_emu_erase (struct nand_emu *emu, unsigned block);
+
+/* 'pages' pages from the start of a block, their data and oob apart */
+int nand_emu_write (struct nand_emu *emu, unsigned block,
+		    const unsigned char *data, const unsigned char *oob,
+		    unsigned pages);
+
+/*
+ * A raw read returns the bit flips as they are; otherwise the emulated
+ * ecc corrects up to 'strength' of them in a page. Returns the bits
+ * corrected, or -1 with EBADMSG for a page beyond repair, the data of
+ * every page read all the same. 'oob' may be NULL.
+ */
+int nand_emu_read (struct nand_emu *emu, unsigned block,
+		   unsigned char *data, unsigned char *oob,
+		   unsigned pages, int raw);
+
+/* the layout of the Linux software hamming ecc for the oob size */
+int nand_emu_ecclayout (const struct nand_emu *emu, nand_ecclayout_t *layout);
+
+#endif
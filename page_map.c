@@ -0,0 +1,150 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "safe_rw.h"
+#include "page_map.h"
+
+/*----------------------------------------------------------------------------*/
+
+static void
+page_map_put32 (unsigned char *p, unsigned v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+static unsigned
+page_map_get32 (const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned)p[3] << 24;
+}
+
+static int
+page_map_erased (const unsigned char *buf, unsigned size)
+{
+	return buf[0] == 0xff && !memcmp(buf, buf + 1, size - 1);
+}
+
+static int
+page_map_grow (struct page_map *map, unsigned pages)
+{
+	size_t size = map->alloc ? map->alloc : 4096;
+	unsigned char *bits;
+
+	while (size * 8 < pages)
+		size *= 2;
+
+	if (size == map->alloc)
+		return 0;
+
+	bits = realloc(map->bits, size);
+	if (bits == NULL)
+		return -1;
+
+	memset(bits + map->alloc, 0, size - map->alloc);
+	map->bits = bits;
+	map->alloc = size;
+
+	return 0;
+}
+
+int
+page_map_add (struct page_map *map, const unsigned char *buf,
+	      unsigned page_sz, unsigned n)
+{
+	unsigned i, page;
+
+	if (map->pages && map->page_sz != page_sz)
+		return -1;
+
+	if (page_map_grow(map, map->pages + n) < 0)
+		return -1;
+
+	map->page_sz = page_sz;
+	for (i = 0; i < n; i++, buf += page_sz) {
+		page = map->pages++;
+		if (!page_map_erased(buf, page_sz)) {
+			map->bits[page >> 3] |= 1 << (page & 7);
+			map->programmed++;
+		}
+	}
+
+	return 0;
+}
+
+int
+page_map_save (const struct page_map *map, int fd)
+{
+	unsigned char hdr[PAGE_MAP_HEADER_SIZE];
+	size_t size = (map->pages + 7) / 8;
+
+	page_map_put32(hdr, PAGE_MAP_MAGIC);
+	page_map_put32(hdr + 4, PAGE_MAP_VERSION);
+	page_map_put32(hdr + 8, map->page_sz);
+	page_map_put32(hdr + 12, map->pages);
+	page_map_put32(hdr + 16, map->programmed);
+
+	if (safe_write(fd, hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    (size && safe_write(fd, map->bits, size) != size))
+		return -1;
+
+	return 0;
+}
+
+int
+page_map_load (struct page_map *map, int fd)
+{
+	unsigned char hdr[PAGE_MAP_HEADER_SIZE];
+	unsigned pages;
+	size_t size;
+
+	if (safe_read(fd, hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    page_map_get32(hdr) != PAGE_MAP_MAGIC ||
+	    page_map_get32(hdr + 4) != PAGE_MAP_VERSION)
+		return -1;
+
+	pages = page_map_get32(hdr + 12);
+	size = (pages + 7) / 8;
+
+	memset(map, 0, sizeof(*map));
+	if (page_map_grow(map, pages) < 0)
+		return -1;
+
+	if (size && safe_read(fd, map->bits, size) != size) {
+		page_map_release(map);
+		return -1;
+	}
+
+	map->page_sz = page_map_get32(hdr + 8);
+	map->pages = pages;
+	map->programmed = page_map_get32(hdr + 16);
+
+	return 0;
+}
+
+void
+page_map_release (struct page_map *map)
+{
+	free(map->bits);
+	memset(map, 0, sizeof(*map));
+}
@@ -0,0 +1,61 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_PAGE_MAP_H__
+#define __YAFFS2UTILS_PAGE_MAP_H__
+
+#include <stddef.h>
+
+/*
+ * The map of the programmed pages of an image, so the erased (all 0xff)
+ * ones need neither a transfer to the flash nor a look at their bytes. The
+ * file is a header of five little endian 32-bit fields: the magic, the
+ * version, the bytes of a page in the image (oob included), the pages and
+ * the programmed ones among them; then bit (p % 8) of byte (p / 8) is set
+ * for every programmed page p.
+ */
+#define PAGE_MAP_MAGIC		0x70616d79	/* "ymap" */
+#define PAGE_MAP_VERSION	1
+#define PAGE_MAP_HEADER_SIZE	20
+
+typedef struct page_map {
+	unsigned page_sz;
+	unsigned pages;
+	unsigned programmed;
+	size_t alloc;			/* bytes of 'bits' */
+	unsigned char *bits;
+} page_map_t;
+
+/* append 'n' pages of 'page_sz' bytes, telling the erased ones apart */
+int page_map_add (struct page_map *map, const unsigned char *buf,
+		  unsigned page_sz, unsigned n);
+
+int page_map_save (const struct page_map *map, int fd);
+
+/* returns -1 if 'fd' holds no page map */
+int page_map_load (struct page_map *map, int fd);
+
+void page_map_release (struct page_map *map);
+
+static inline int
+page_map_test (const struct page_map *map, unsigned page)
+{
+	return page < map->pages && (map->bits[page >> 3] >> (page & 7)) & 1;
+}
+
+#endif
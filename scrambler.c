@@ -0,0 +1,268 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "configs.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define _HAVE_X86_SIMD		1
+#endif
+#ifdef _HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+#include "scrambler.h"
+
+/*----------------------------------------------------------------------------*/
+
+typedef struct scrambler_kernel {
+	const char *name;
+	int (*supported) (void);
+	void (*xor) (unsigned char *, const unsigned char *, unsigned);
+} scrambler_kernel_t;
+
+static void scrambler_xor_word (unsigned char *data,
+				const unsigned char *key, unsigned size);
+
+/* the word kernel until one is resolved by scrambler_init() */
+static void
+(*scrambler_xor_fn) (unsigned char *, const unsigned char *, unsigned) =
+	scrambler_xor_word;
+
+static const char *scrambler_kernel_name = NULL;
+
+static pthread_once_t scrambler_kernel_once = PTHREAD_ONCE_INIT;
+
+static int
+scrambler_always (void)
+{
+	return 1;
+}
+
+static void
+scrambler_xor_word (unsigned char *data, const unsigned char *key,
+		    unsigned size)
+{
+	unsigned i;
+	uint64_t w, k;
+
+	for (i = 0; i + 8 <= size; i += 8) {
+		memcpy(&w, data + i, sizeof(w));
+		memcpy(&k, key + i, sizeof(k));
+		w ^= k;
+		memcpy(data + i, &w, sizeof(w));
+	}
+
+	for (; i < size; i++)
+		data[i] ^= key[i];
+}
+
+#ifdef _HAVE_X86_SIMD
+static int
+scrambler_has_sse2 (void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("sse2")))
+static void
+scrambler_xor_sse2 (unsigned char *data, const unsigned char *key,
+		    unsigned size)
+{
+	unsigned i;
+	__m128i v, k;
+
+	for (i = 0; i + 16 <= size; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(data + i));
+		k = _mm_loadu_si128((const __m128i *)(key + i));
+		_mm_storeu_si128((__m128i *)(data + i), _mm_xor_si128(v, k));
+	}
+
+	scrambler_xor_word(data + i, key + i, size - i);
+}
+
+static int
+scrambler_has_avx2 (void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void
+scrambler_xor_avx2 (unsigned char *data, const unsigned char *key,
+		    unsigned size)
+{
+	unsigned i;
+	__m256i v, k;
+
+	for (i = 0; i + 32 <= size; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)(data + i));
+		k = _mm256_loadu_si256((const __m256i *)(key + i));
+		_mm256_storeu_si256((__m256i *)(data + i),
+				    _mm256_xor_si256(v, k));
+	}
+
+	scrambler_xor_word(data + i, key + i, size - i);
+}
+#endif
+
+#ifdef _HAVE_NEON
+static void
+scrambler_xor_neon (unsigned char *data, const unsigned char *key,
+		    unsigned size)
+{
+	unsigned i;
+
+	for (i = 0; i + 16 <= size; i += 16)
+		vst1q_u8(data + i, veorq_u8(vld1q_u8(data + i),
+					    vld1q_u8(key + i)));
+
+	scrambler_xor_word(data + i, key + i, size - i);
+}
+#endif
+
+/* the preferred kernel comes first */
+static const struct scrambler_kernel scrambler_kernels[] = {
+#ifdef _HAVE_X86_SIMD
+	{"avx2",	scrambler_has_avx2,	scrambler_xor_avx2},
+	{"sse2",	scrambler_has_sse2,	scrambler_xor_sse2},
+#endif
+#ifdef _HAVE_NEON
+	{"neon",	scrambler_always,	scrambler_xor_neon},
+#endif
+	{"word",	scrambler_always,	scrambler_xor_word},
+	{NULL,		NULL,			NULL},
+};
+
+int
+scrambler_select (const char *name)
+{
+	const struct scrambler_kernel *k;
+
+	for (k = scrambler_kernels; k->name != NULL; k++) {
+		if (name != NULL && strcmp(name, k->name))
+			continue;
+
+		if (k->supported()) {
+			scrambler_kernel_name = k->name;
+			scrambler_xor_fn = k->xor;
+			return 0;
+		}
+
+		if (name != NULL)
+			break;
+	}
+
+	return -1;
+}
+
+/* the preferred kernel, unless one was selected already */
+static void
+scrambler_resolve (void)
+{
+	if (scrambler_kernel_name == NULL)
+		scrambler_select(NULL);
+}
+
+const char *
+scrambler_name (void)
+{
+	pthread_once(&scrambler_kernel_once, scrambler_resolve);
+
+	return scrambler_kernel_name;
+}
+
+/*----------------------------------------------------------------------------*/
+
+static void
+scrambler_prbs15 (unsigned state, unsigned char *key, unsigned size)
+{
+	unsigned i, j, bit;
+
+	for (i = 0; i < size; i++) {
+		key[i] = 0;
+		for (j = 0; j < 8; j++) {
+			bit = ((state >> 14) ^ (state >> 13)) & 1;
+			state = ((state << 1) | bit) & 0x7fff;
+			key[i] = (key[i] << 1) | bit;
+		}
+	}
+}
+
+int
+scrambler_init (struct scrambler *s, unsigned seed, unsigned size,
+		unsigned period)
+{
+	unsigned i, state;
+
+	/* before any worker of the caller calls scrambler_page() */
+	pthread_once(&scrambler_kernel_once, scrambler_resolve);
+
+	if (size == 0 || period == 0)
+		return -1;
+
+	s->keys = malloc((size_t)size * period);
+	if (s->keys == NULL)
+		return -1;
+
+	s->seed = seed;
+	s->size = size;
+	s->period = period;
+
+	for (i = 0; i < period; i++) {
+		state = (seed + i * 0x2b5) & 0x7fff;
+		scrambler_prbs15(state ? state : 1,
+				 s->keys + (size_t)i * size, size);
+	}
+
+	return 0;
+}
+
+void
+scrambler_release (struct scrambler *s)
+{
+	free(s->keys);
+	s->keys = NULL;
+}
+
+static int
+scrambler_erased (const unsigned char *buf, unsigned size)
+{
+	return size == 0 || (buf[0] == 0xff && !memcmp(buf, buf + 1, size - 1));
+}
+
+void
+scrambler_page (const struct scrambler *s, unsigned page,
+		unsigned char *data, const unsigned char *spare,
+		unsigned sparesize)
+{
+	/* like the controllers, leave the erased pages to read as erased */
+	if (scrambler_erased(spare, sparesize) &&
+	    scrambler_erased(data, s->size))
+		return;
+
+	scrambler_xor_fn(data, s->keys + (size_t)(page % s->period) * s->size,
+			 s->size);
+}
@@ -0,0 +1,54 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_SCRAMBLER_H__
+#define __YAFFS2UTILS_SCRAMBLER_H__
+
+#define SCRAMBLER_PERIOD	128
+
+/*
+ * The data randomizer of NAND controllers: the data area of every page is
+ * XORed with a PRBS15 (x^15 + x^14 + 1) keystream, and the same XOR takes
+ * it back. Page p uses the keystream p % period, which starts the LFSR from
+ * (seed + p % period * 0x2b5) & 0x7fff (0 taken as 1). The keystreams of a
+ * period are worked out once, so a page costs one XOR pass.
+ */
+typedef struct scrambler {
+	unsigned seed;
+	unsigned size;			/* data bytes of a page */
+	unsigned period;		/* keystreams before they repeat */
+	unsigned char *keys;		/* period * size bytes */
+} scrambler_t;
+
+int scrambler_init (struct scrambler *s, unsigned seed, unsigned size,
+		    unsigned period);
+void scrambler_release (struct scrambler *s);
+
+/* both ways; a page erased in the data and the spare is left as it is */
+void scrambler_page (const struct scrambler *s, unsigned page,
+		     unsigned char *data, const unsigned char *spare,
+		     unsigned sparesize);
+
+/*
+ * The XOR kernel, the fastest supported by the running CPU by default. It
+ * is resolved once by scrambler_init(), before the caller starts threads.
+ */
+int scrambler_select (const char *name);
+const char *scrambler_name (void);
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "safe_rw.h"
+#include "sparse_image.h"
+
+/*----------------------------------------------------------------------------*/
+
+static void
+sparse_put16 (unsigned char *p, unsigned v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static void
+sparse_put32 (unsigned char *p, unsigned v)
+{
+	sparse_put16(p, v & 0xffff);
+	sparse_put16(p + 2, v >> 16);
+}
+
+static void
+sparse_header (const struct sparse_image *sp, unsigned char *hdr)
+{
+	sparse_put32(hdr, SPARSE_HEADER_MAGIC);
+	sparse_put16(hdr + 4, SPARSE_MAJOR_VERSION);
+	sparse_put16(hdr + 6, SPARSE_MINOR_VERSION);
+	sparse_put16(hdr + 8, SPARSE_HEADER_SIZE);
+	sparse_put16(hdr + 10, SPARSE_CHUNK_HEADER_SIZE);
+	sparse_put32(hdr + 12, sp->blk_sz);
+	sparse_put32(hdr + 16, sp->total_blks);
+	sparse_put32(hdr + 20, sp->total_chunks);
+	sparse_put32(hdr + 24, 0);		/* no image checksum */
+}
+
+/* a block repeating its first 4 bytes equals itself shifted by 4 bytes */
+static int
+sparse_isfill (const unsigned char *blk, unsigned size)
+{
+	return !memcmp(blk, blk + 4, size - 4);
+}
+
+static int
+sparse_write_chunk (struct sparse_image *sp, unsigned type, unsigned blks,
+		    const unsigned char *data, size_t bytes)
+{
+	unsigned char hdr[SPARSE_CHUNK_HEADER_SIZE];
+
+	sparse_put16(hdr, type);
+	sparse_put16(hdr + 2, 0);
+	sparse_put32(hdr + 4, blks);
+	sparse_put32(hdr + 8, SPARSE_CHUNK_HEADER_SIZE + bytes);
+
+	if (safe_write(sp->fd, hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    safe_write(sp->fd, data, bytes) != bytes)
+		return -1;
+
+	sp->total_chunks++;
+
+	return 0;
+}
+
+static int
+sparse_flush_fill (struct sparse_image *sp)
+{
+	if (sp->fill_blks == 0)
+		return 0;
+
+	if (sparse_write_chunk(sp, SPARSE_CHUNK_FILL, sp->fill_blks,
+			       sp->fill, sizeof(sp->fill)))
+		return -1;
+
+	sp->fill_total += sp->fill_blks;
+	sp->fill_blks = 0;
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
+int
+sparse_image_start (struct sparse_image *sp, int fd, unsigned blk_sz)
+{
+	unsigned char hdr[SPARSE_HEADER_SIZE];
+
+	if (blk_sz == 0 || blk_sz % 4)
+		return -1;
+
+	memset(sp, 0, sizeof(struct sparse_image));
+	sp->fd = fd;
+	sp->blk_sz = blk_sz;
+
+	/* a placeholder, until the totals are known */
+	sparse_header(sp, hdr);
+
+	return safe_write(fd, hdr, sizeof(hdr)) != sizeof(hdr) ? -1 : 0;
+}
+
+int
+sparse_image_write (struct sparse_image *sp, const unsigned char *buf,
+		    unsigned blks)
+{
+	unsigned i, n;
+	const unsigned char *blk;
+
+	for (i = 0; i < blks; i += n) {
+		blk = buf + (size_t)i * sp->blk_sz;
+
+		if (sparse_isfill(blk, sp->blk_sz)) {
+			if (sp->fill_blks && memcmp(sp->fill, blk, 4) &&
+			    sparse_flush_fill(sp))
+				return -1;
+
+			memcpy(sp->fill, blk, 4);
+			sp->fill_blks++;
+			n = 1;
+			continue;
+		}
+
+		if (sparse_flush_fill(sp))
+			return -1;
+
+		for (n = 1; i + n < blks; n++) {
+			if (sparse_isfill(blk + (size_t)n * sp->blk_sz,
+					  sp->blk_sz))
+				break;
+		}
+
+		if (sparse_write_chunk(sp, SPARSE_CHUNK_RAW, n, blk,
+				       (size_t)n * sp->blk_sz))
+			return -1;
+	}
+
+	sp->total_blks += blks;
+
+	return 0;
+}
+
+int
+sparse_image_finish (struct sparse_image *sp)
+{
+	unsigned char hdr[SPARSE_HEADER_SIZE];
+
+	if (sparse_flush_fill(sp))
+		return -1;
+
+	sparse_header(sp, hdr);
+
+	return pwrite(sp->fd, hdr, sizeof(hdr), 0) != sizeof(hdr) ? -1 : 0;
+}
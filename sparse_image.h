@@ -0,0 +1,65 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_SPARSE_IMAGE_H__
+#define __YAFFS2UTILS_SPARSE_IMAGE_H__
+
+/*
+ * The Android sparse image (system/core/libsparse), as taken by fastboot
+ * and most flashing stations: a file header, then chunks of blocks, each
+ * either raw data or a 32-bit pattern filled over the blocks. All the
+ * fields are little endian.
+ */
+#define SPARSE_HEADER_MAGIC	0xed26ff3a
+#define SPARSE_MAJOR_VERSION	1
+#define SPARSE_MINOR_VERSION	0
+
+#define SPARSE_HEADER_SIZE	28
+#define SPARSE_CHUNK_HEADER_SIZE 12
+
+#define SPARSE_CHUNK_RAW	0xcac1
+#define SPARSE_CHUNK_FILL	0xcac2
+#define SPARSE_CHUNK_DONT_CARE	0xcac3
+#define SPARSE_CHUNK_CRC32	0xcac4
+
+typedef struct sparse_image {
+	int fd;
+	unsigned blk_sz;		/* a multiple of 4 bytes */
+	unsigned total_blks;
+	unsigned total_chunks;
+	unsigned fill_blks;		/* blocks of the pending FILL chunk */
+	unsigned fill_total;		/* blocks in all the FILL chunks */
+	unsigned char fill[4];
+} sparse_image_t;
+
+/*
+ * Start a sparse image at the current (zero) offset of the seekable 'fd';
+ * the file header is written with its totals by sparse_image_finish().
+ */
+int sparse_image_start (struct sparse_image *sp, int fd, unsigned blk_sz);
+
+/*
+ * Append 'blks' blocks. The runs of blocks made of one 32-bit pattern
+ * (such as the erased pages) become FILL chunks, the rest RAW chunks.
+ */
+int sparse_image_write (struct sparse_image *sp, const unsigned char *buf,
+			unsigned blks);
+
+int sparse_image_finish (struct sparse_image *sp);
+
+#endif
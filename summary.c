@@ -0,0 +1,148 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "endian_convert.h"
+#include "summary.h"
+
+/*----------------------------------------------------------------------------*/
+
+static inline unsigned
+summary_bytes_per_chunk (unsigned chunksize)
+{
+	return chunksize - sizeof(struct summary_header);
+}
+
+static unsigned
+summary_sum (const struct summary_tags *tags, unsigned n)
+{
+	unsigned i, sum = 0;
+	const unsigned char *p = (const unsigned char *)tags;
+
+	/* a byte sum, the same in both byte orders */
+	for (i = 0; i < n * sizeof(struct summary_tags); i++)
+		sum += p[i];
+
+	return sum;
+}
+
+static void
+summary_swap (unsigned *words, unsigned n)
+{
+	while (n--) {
+		*words = ENDIAN_SWAP_32(*words);
+		words++;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+
+unsigned
+summary_chunks (unsigned chunksize, unsigned pages_per_block)
+{
+	unsigned bytes = pages_per_block * sizeof(struct summary_tags);
+	unsigned used;
+
+	if (chunksize <= sizeof(struct summary_header))
+		return 0;
+
+	/* as yaffs_summary_init() rounds it */
+	used = (bytes + chunksize - 1) / summary_bytes_per_chunk(chunksize);
+
+	return used < pages_per_block ? pages_per_block - used : 0;
+}
+
+unsigned
+summary_fill (unsigned char *buf, unsigned chunksize,
+	      const struct summary_tags *tags, unsigned n,
+	      unsigned index, unsigned block, unsigned seq, int swap)
+{
+	unsigned bytes, offset;
+	struct summary_header hdr;
+
+	offset = index * summary_bytes_per_chunk(chunksize);
+	if (offset >= n * sizeof(struct summary_tags))
+		return 0;
+
+	bytes = n * sizeof(struct summary_tags) - offset;
+	if (bytes > summary_bytes_per_chunk(chunksize))
+		bytes = summary_bytes_per_chunk(chunksize);
+
+	hdr.version = SUMMARY_VERSION;
+	hdr.block = block;
+	hdr.seq = seq;
+	hdr.sum = summary_sum(tags, n);
+
+	memcpy(buf, &hdr, sizeof(struct summary_header));
+	memcpy(buf + sizeof(struct summary_header),
+	       (const unsigned char *)tags + offset, bytes);
+
+	if (swap) {
+		summary_swap((unsigned *)buf,
+			     (sizeof(struct summary_header) + bytes) /
+			     sizeof(unsigned));
+	}
+
+	return bytes + sizeof(struct summary_header);
+}
+
+int
+summary_collect (struct summary_tags *tags, unsigned n,
+		 struct summary_header *hdr, const unsigned char *buf,
+		 unsigned chunksize, unsigned index, unsigned n_bytes,
+		 int swap)
+{
+	unsigned bytes, offset;
+	unsigned char *p = (unsigned char *)tags;
+
+	offset = index * summary_bytes_per_chunk(chunksize);
+	if (offset >= n * sizeof(struct summary_tags))
+		return -1;
+
+	bytes = n * sizeof(struct summary_tags) - offset;
+	if (bytes > summary_bytes_per_chunk(chunksize))
+		bytes = summary_bytes_per_chunk(chunksize);
+
+	/* yaffs_summary_read() insists on the exact size */
+	if (n_bytes != bytes + sizeof(struct summary_header))
+		return -1;
+
+	memcpy(hdr, buf, sizeof(struct summary_header));
+	memcpy(p + offset, buf + sizeof(struct summary_header), bytes);
+
+	if (swap) {
+		summary_swap((unsigned *)hdr, sizeof(struct summary_header) /
+					      sizeof(unsigned));
+		summary_swap((unsigned *)(p + offset),
+			     bytes / sizeof(unsigned));
+	}
+
+	return 0;
+}
+
+int
+summary_check (const struct summary_tags *tags, unsigned n,
+	       const struct summary_header *hdr, unsigned seq)
+{
+	if (hdr->version != SUMMARY_VERSION || hdr->seq != seq ||
+	    hdr->sum != summary_sum(tags, n))
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_SUMMARY_H__
+#define __YAFFS2UTILS_SUMMARY_H__
+
+/*
+ * The block summary of the YAFFS2 kernel code (yaffs_summary.c): the
+ * packed tags of the data chunks of a block, stored in its last chunks
+ * with the object id YAFFS_OBJECTID_SUMMARY.
+ */
+#define SUMMARY_VERSION		1
+
+typedef struct summary_header {
+	unsigned version;
+	unsigned block;			/* internal block number */
+	unsigned seq;			/* sequence number of the block */
+	unsigned sum;			/* sum of the bytes of the tags */
+} summary_header_t;
+
+typedef struct summary_tags {
+	unsigned obj_id;
+	unsigned chunk_id;
+	unsigned n_bytes;
+} summary_tags_t;
+
+/* data chunks of a block followed by a summary, 0 if it does not fit */
+unsigned summary_chunks (unsigned chunksize, unsigned pages_per_block);
+
+/*
+ * Fill the buffer of the 'index'-th summary chunk of a block from the
+ * tags of its 'n' data chunks. Returns the n_bytes of the chunk, or 0
+ * past the last summary chunk. 'swap' converts to the other byte order.
+ */
+unsigned summary_fill (unsigned char *buf, unsigned chunksize,
+		       const struct summary_tags *tags, unsigned n,
+		       unsigned index, unsigned block, unsigned seq, int swap);
+
+/*
+ * Take the tags out of the 'index'-th summary chunk with its n_bytes.
+ * Returns -1 if the chunk does not belong to a valid summary; the whole
+ * summary is only known to be good once summary_check() agrees.
+ */
+int summary_collect (struct summary_tags *tags, unsigned n,
+		     struct summary_header *hdr, const unsigned char *buf,
+		     unsigned chunksize, unsigned index, unsigned n_bytes,
+		     int swap);
+int summary_check (const struct summary_tags *tags, unsigned n,
+		   const struct summary_header *hdr, unsigned seq);
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "thread_pool.h"
+
+/*----------------------------------------------------------------------------*/
+
+struct thread_pool {
+	unsigned threads;		/* workers, the caller excluded */
+	pthread_t *tids;
+
+	pthread_mutex_t run;		/* one caller at a time */
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+
+	unsigned generation;		/* bumped on every run */
+	unsigned busy;			/* workers still in this run */
+	int exiting;
+
+	thread_pool_fn_t fn;
+	void *arg;
+	unsigned jobs;
+	unsigned next;			/* next job to be taken */
+};
+
+/*----------------------------------------------------------------------------*/
+
+static void
+thread_pool_drain (struct thread_pool *pool)
+{
+	unsigned job;
+
+	while ((job = __sync_fetch_and_add(&pool->next, 1)) < pool->jobs)
+		pool->fn(pool->arg, job);
+}
+
+static void *
+thread_pool_worker (void *data)
+{
+	unsigned generation = 0;
+	struct thread_pool *pool = data;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->exiting && generation == pool->generation)
+			pthread_cond_wait(&pool->start, &pool->lock);
+
+		if (pool->exiting)
+			break;
+
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		thread_pool_drain(pool);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+
+unsigned
+thread_pool_cpus (void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? n : 1;
+}
+
+struct thread_pool *
+thread_pool_create (unsigned threads)
+{
+	unsigned i;
+	struct thread_pool *pool;
+
+	pool = calloc(sizeof(struct thread_pool), sizeof(unsigned char));
+	if (pool == NULL)
+		return NULL;
+
+	pthread_mutex_init(&pool->run, NULL);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	/* the caller of thread_pool_run() is a worker as well */
+	if (threads > 1) {
+		pool->tids = calloc(threads - 1, sizeof(pthread_t));
+		if (pool->tids == NULL) {
+			thread_pool_destroy(pool);
+			return NULL;
+		}
+
+		for (i = 0; i < threads - 1; i++) {
+			if (pthread_create(&pool->tids[i], NULL,
+					   thread_pool_worker, pool))
+				break;
+			pool->threads++;
+		}
+	}
+
+	return pool;
+}
+
+void
+thread_pool_destroy (struct thread_pool *pool)
+{
+	unsigned i;
+
+	if (pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->exiting = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->threads; i++)
+		pthread_join(pool->tids[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_mutex_destroy(&pool->run);
+
+	free(pool->tids);
+	free(pool);
+}
+
+void
+thread_pool_run (struct thread_pool *pool, unsigned jobs,
+		 thread_pool_fn_t fn, void *arg)
+{
+	unsigned i;
+
+	if (pool == NULL || pool->threads == 0 || jobs < 2) {
+		for (i = 0; i < jobs; i++)
+			fn(arg, i);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->run);
+	pthread_mutex_lock(&pool->lock);
+	pool->fn = fn;
+	pool->arg = arg;
+	pool->jobs = jobs;
+	pool->next = 0;
+	pool->busy = pool->threads;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	thread_pool_drain(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+	pthread_mutex_unlock(&pool->run);
+}
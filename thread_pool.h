@@ -0,0 +1,38 @@
+/*
+ * yaffs2utils: Utilities to make/extract a YAFFS2/YAFFS1 image.
+ * Copyright (C) 2010-2011 Luen-Yung Lin <penguin.lin@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __YAFFS2UTILS_THREAD_POOL_H__
+#define __YAFFS2UTILS_THREAD_POOL_H__
+
+typedef struct thread_pool thread_pool_t;
+
+typedef void (*thread_pool_fn_t) (void *arg, unsigned job);
+
+unsigned thread_pool_cpus (void);
+
+struct thread_pool *thread_pool_create (unsigned threads);
+void thread_pool_destroy (struct thread_pool *pool);
+
+/*
+ * run fn(arg, 0 .. jobs - 1) on the pool and wait for all of them; runs
+ * from several threads take turns.
+ */
+void thread_pool_run (struct thread_pool *pool, unsigned jobs,
+		      thread_pool_fn_t fn, void *arg);
+
+#endif
@@ -29,16 +29,12 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <getopt.h>
-#include <sys/ioctl.h>
-#ifndef _HAVE_BROKEN_MTD_H
-#include <mtd/mtd-user.h>
-#else
-#include "mtd-abi.h"
-#endif
 
 #include "safe_rw.h"
 #include "endian_convert.h"
+#include "mtd_dev.h"
 
 #include "version.h"
 
@@ -48,6 +44,11 @@
 
 #define UNSPARE2_ISENDIAN       (unspare2_flags & UNSPARE2_FLAGS_ENDIAN)
 
+/* the geometry of a file emulating the device, unless its options tell */
+#define UNSPARE2_EMU_PAGESIZE	2048
+#define UNSPARE2_EMU_SPARESIZE	64
+#define UNSPARE2_EMU_PAGES	64
+
 #define UNSPARE2_PRINTF(s, args...) \
 		do { \
 			fprintf(stdout, s, ##args); \
@@ -108,20 +109,21 @@ unspare2_dump (const char *devfile, const char *imgfile)
 	int fd, retval = 0;
 	ssize_t written;
 	nand_ecclayout_t oob;
+	struct mtd_dev dev;
 
-	/* get the ecc layout via ioctl() */
-	/* FIXME: ECCGETLAYOUT is deprecated in the latest kernel. */
-	memset(&oob, 0, sizeof(nand_ecclayout_t));
-
-	if ((fd = open(devfile, O_RDWR)) < 0) {
-		retval = -1;
-		UNSPARE2_ERROR("cannot open the device %s\n", devfile);
+	/* get the ecc layout of the device, or of the file emulating one */
+	if (mtd_dev_open(&dev, devfile, UNSPARE2_EMU_PAGESIZE,
+			 UNSPARE2_EMU_SPARESIZE, UNSPARE2_EMU_PAGES) < 0) {
+		UNSPARE2_ERROR("cannot open the device %s: %s\n", devfile,
+			       strerror(errno));
+		return -1;
 	}
 
-	if ((retval = ioctl(fd, ECCGETLAYOUT, &oob)) < 0)
-		UNSPARE2_ERROR("ioctl failed\n");
+	if ((retval = mtd_dev_ecclayout(&dev, &oob)) < 0)
+		UNSPARE2_ERROR("cannot get the oob layout: %s\n",
+			       strerror(errno));
 
-	close(fd);
+	mtd_dev_close(&dev);
 
 	if (retval)
 		return retval;
@@ -157,6 +159,9 @@ unspare2_helper (void)
 {
 	UNSPARE2_HELP("unspare2 %s - A utility to extract the OOB layout\n\n", YAFFS2UTILS_VERSION);
 	UNSPARE2_HELP("Usage: unspare2 devfile imgfile\n\n");
+	UNSPARE2_HELP("devfile may be a file emulating the NAND, with its options\n"
+		      "(e.g. nand.bin,oobsize=128,ppb=64; %u + %u bytes pages by default).\n\n",
+		      UNSPARE2_EMU_PAGESIZE, UNSPARE2_EMU_SPARESIZE);
 	UNSPARE2_HELP("options:\n");
 	UNSPARE2_HELP("  -h  display this help message and exit.\n");
 	UNSPARE2_HELP("  -e  convert the endian differed from the local machine.\n");
@@ -49,6 +49,15 @@
 #include "progress_bar.h"
 #include "endian_convert.h"
 #include "nand_ecclayout.h"
+#include "nand_ecc.h"
+#include "thread_pool.h"
+#include "checkpoint.h"
+#include "summary.h"
+#include "scrambler.h"
+#include "page_map.h"
+#include "crc32c.h"
+#include "mtd_dev.h"
+#include "mtd_verify.h"
 
 #include "version.h"
 
@@ -56,6 +65,8 @@
 
 #define UNYAFFS2_OBJTABLE_SIZE	4096
 #define UNYAFFS2_HARDLINK_MAX	127
+#define UNYAFFS2_ECC_BATCH	64	/* pages per ecc job */
+#define UNYAFFS2_TAGS_BATCH	64	/* spares per tags ecc check */
 
 #define UNYAFFS2_FLAGS_NONROOT	(1 << 0)
 #define UNYAFFS2_FLAGS_SHOWBAR	(1 << 1)
@@ -63,12 +74,18 @@
 #define UNYAFFS2_FLAGS_ENDIAN	(1 << 17)
 #define UNYAFFS2_FLAGS_YAFFSECC	(1 << 18)
 #define UNYAFFS2_FLAGS_VERBOSE	(1 << 19)
+#define UNYAFFS2_FLAGS_INBAND	(1 << 20)
+#define UNYAFFS2_FLAGS_SYNDROME	(1 << 21)
+#define UNYAFFS2_FLAGS_SCRAMBLE	(1 << 22)
 
 #define UNYAFFS2_ISSHOWBAR	(unyaffs2_flags & UNYAFFS2_FLAGS_SHOWBAR)
 #define UNYAFFS2_ISYAFFS1	(unyaffs2_flags & UNYAFFS2_FLAGS_YAFFS1)
 #define UNYAFFS2_ISENDIAN	(unyaffs2_flags & UNYAFFS2_FLAGS_ENDIAN)
 #define UNYAFFS2_ISYAFFSECC	(unyaffs2_flags & UNYAFFS2_FLAGS_YAFFSECC)
 #define UNYAFFS2_ISVERBOSE	(unyaffs2_flags & UNYAFFS2_FLAGS_VERBOSE)
+#define UNYAFFS2_ISINBAND	(unyaffs2_flags & UNYAFFS2_FLAGS_INBAND)
+#define UNYAFFS2_ISSYNDROME	(unyaffs2_flags & UNYAFFS2_FLAGS_SYNDROME)
+#define UNYAFFS2_ISSCRAMBLE	(unyaffs2_flags & UNYAFFS2_FLAGS_SCRAMBLE)
 
 #define UNYAFFS2_PRINTF(s, args...) \
 		do { \
@@ -130,7 +147,9 @@
 
 typedef struct unyaffs2_file_var {
 	loff_t file_size;
-	off_t file_head;
+	off_t file_head;		/* first and last data chunks */
+	off_t file_tail;
+	unsigned data_chunks;		/* the holes are not there */
 } unyaffs2_file_var_t;
 
 typedef struct unyaffs2_symlink_var {
@@ -156,6 +175,9 @@ typedef struct unyaffs2_obj {
 	unsigned char valid:1;
 	unsigned char extracted:1;	/* 1 when extracted. */
 
+	unsigned ecc_bits;		/* bitflips corrected in the data */
+	unsigned ecc_failed;		/* uncorrectable data chunks */
+
 	off_t hdr_off;			/* header offset in the image */
 
 	unsigned obj_id;
@@ -195,7 +217,9 @@ typedef struct unyaffs2_specfile {
 #ifdef _HAVE_MMAP
 typedef struct unyaffs2_mmap {
 	unsigned char *addr;
-	size_t size;
+	size_t size;			/* as the interleaved image */
+	unsigned char *spare;		/* split spare file, or NULL */
+	size_t sparesize;
 } unyaffs2_mmap_t;
 #endif
 
@@ -212,6 +236,10 @@ static unsigned unyaffs2_bufsize = 0;
 static unsigned char *unyaffs2_databuf = NULL;
 
 static int unyaffs2_image_fd = -1;
+static int unyaffs2_spare_fd = -1;		/* split spare input */
+static const char *unyaffs2_sparefile = NULL;
+static const char *unyaffs2_mapfile = NULL;
+static const char *unyaffs2_verify_path = NULL;	/* device to check */
 
 static char unyaffs2_curfile[PATH_MAX + PATH_MAX] = {0};
 static char unyaffs2_linkfile[PATH_MAX + PATH_MAX] = {0};
@@ -219,12 +247,37 @@ static char unyaffs2_linkfile[PATH_MAX + PATH_MAX] = {0};
 static LIST_HEAD(unyaffs2_specfile_list);	/* specfied files */
 
 static nand_ecclayout_t *unyaffs2_ecclayout = NULL;
+static nand_ecclayout_t unyaffs2_syndrome_layout = {0};
+static unsigned char *unyaffs2_physbuf = NULL;	/* a syndrome page */
 
 static struct unyaffs2_fstree unyaffs2_objtree = {0};
 static struct list_head unyaffs2_objtable[UNYAFFS2_OBJTABLE_SIZE];
 
 #ifdef _HAVE_MMAP
 static struct unyaffs2_mmap unyaffs2_mmapinfo = {0};
+static struct page_map unyaffs2_pagemap = {0};
+#endif
+
+static unsigned unyaffs2_threads = 0;
+
+static struct nand_ecc_ctrl unyaffs2_ecc = {0};
+
+static unsigned unyaffs2_scramble_seed = 0;
+static unsigned unyaffs2_scramble_period = 0;
+static struct scrambler unyaffs2_scrambler = {0};
+static unsigned unyaffs2_ecc_bits = 0;		/* bitflips corrected */
+static unsigned unyaffs2_ecc_failed = 0;	/* uncorrectable pages */
+static unsigned unyaffs2_ecc_files = 0;		/* files corrected */
+static unsigned unyaffs2_ecc_broken = 0;	/* files left broken */
+
+static unsigned unyaffs2_pages_per_block = 0;
+#ifdef _HAVE_MMAP
+static int *unyaffs2_ecc_result = NULL;		/* per page */
+
+static unsigned unyaffs2_summary_chunks = 0;
+static unsigned unyaffs2_summary_blocks = 0;	/* scanned by summary */
+static struct summary_tags *unyaffs2_summary = NULL;
+static struct yaffs_ext_tags *unyaffs2_summary_tags = NULL;
 #endif
 
 static void
@@ -233,6 +286,34 @@ static void
 
 /*----------------------------------------------------------------------------*/
 
+#ifdef _HAVE_MMAP
+/*
+ * The data and the spare of the page at 'offset' of the image; the offsets
+ * are those of the interleaved image, with the spares split out or not.
+ */
+static inline unsigned char *
+unyaffs2_page_data (off_t offset)
+{
+	if (unyaffs2_mmapinfo.spare)
+		return unyaffs2_mmapinfo.addr +
+		       offset / unyaffs2_bufsize * unyaffs2_chunksize;
+
+	return unyaffs2_mmapinfo.addr + offset;
+}
+
+static inline unsigned char *
+unyaffs2_page_spare (off_t offset)
+{
+	if (unyaffs2_mmapinfo.spare)
+		return unyaffs2_mmapinfo.spare +
+		       offset / unyaffs2_bufsize * unyaffs2_sparesize;
+
+	return unyaffs2_mmapinfo.addr + offset + unyaffs2_chunksize;
+}
+#endif
+
+/*----------------------------------------------------------------------------*/
+
 static struct unyaffs2_obj *
 unyaffs2_obj_alloc (void)
 {
@@ -559,31 +640,28 @@ unyaffs2_extract_ptags1 (struct yaffs_ext_tags *t, unsigned char *pt,
 	yaffs_unpack_tags1(t, &pt1);
 }
 
+/* check (and fix) the tags part by its ecc, then unpack it */
 static void
-unyaffs2_extract_ptags2 (struct yaffs_ext_tags *t, unsigned char *s,
-			 nand_ecclayout_t *ecclayout, int ecc)
+unyaffs2_verify_ptags2 (struct yaffs_ext_tags *t,
+			struct yaffs_packed_tags2 *pt2,
+			struct yaffs_ecc_other *tag_ecc)
 {
 	int result;
 	enum yaffs_ecc_result ecc_result = YAFFS_ECC_RESULT_NO_ERROR;
-	struct yaffs_ecc_other tag_ecc;
-	struct yaffs_packed_tags2 pt2;
-	nand_ecclayout_t *l = ecclayout ? ecclayout : unyaffs2_ecclayout;
 
-	memset(&pt2, 0xff, sizeof(struct yaffs_packed_tags2));
-	unyaffs2_spare2ptags((unsigned char *)&pt2, s,
-			     sizeof(struct yaffs_packed_tags2), l);
-
-	if (pt2.t.seq_number != 0xffffffff && ecc) {
+	if (pt2->t.seq_number != 0xffffffff && tag_ecc) {
 		if (UNYAFFS2_ISENDIAN)
-			packedtags2_eccother_endian_convert(&pt2);
-
-		yaffs_ecc_calc_other((unsigned char *)&pt2.t,
-				sizeof(struct yaffs_packed_tags2_tags_only),
-				&tag_ecc);
-
-		result = yaffs_ecc_correct_other((unsigned char *)&pt2.t,
-				sizeof(struct yaffs_packed_tags2_tags_only),
-				&pt2.ecc, &tag_ecc);
+			packedtags2_eccother_endian_convert(pt2);
+
+		/* the scalar correction only runs on a mismatch */
+		result = 0;
+		if (pt2->ecc.col_parity != tag_ecc->col_parity ||
+		    pt2->ecc.line_parity != tag_ecc->line_parity ||
+		    pt2->ecc.line_parity_prime != tag_ecc->line_parity_prime) {
+			result = yaffs_ecc_correct_other((unsigned char *)&pt2->t,
+					sizeof(struct yaffs_packed_tags2_tags_only),
+					&pt2->ecc, tag_ecc);
+		}
 
 		switch (result) {
 		case 0:
@@ -601,13 +679,82 @@ unyaffs2_extract_ptags2 (struct yaffs_ext_tags *t, unsigned char *s,
 	}
 
 	if (UNYAFFS2_ISENDIAN)
-		packedtags2_tagspart_endian_convert(&pt2);
+		packedtags2_tagspart_endian_convert(pt2);
 
-	yaffs_unpack_tags2_tags_only(t, &pt2.t);
+	yaffs_unpack_tags2_tags_only(t, &pt2->t);
 
 	t->ecc_result = ecc_result;
 }
 
+static void
+unyaffs2_extract_ptags2 (struct yaffs_ext_tags *t, unsigned char *s,
+			 nand_ecclayout_t *ecclayout, int ecc)
+{
+	struct yaffs_ecc_other tag_ecc;
+	struct yaffs_packed_tags2 pt2;
+	nand_ecclayout_t *l = ecclayout ? ecclayout : unyaffs2_ecclayout;
+
+	memset(&pt2, 0xff, sizeof(struct yaffs_packed_tags2));
+	unyaffs2_spare2ptags((unsigned char *)&pt2, s,
+			     sizeof(struct yaffs_packed_tags2), l);
+
+	if (ecc) {
+		yaffs_ecc_calc_other((unsigned char *)&pt2.t,
+				sizeof(struct yaffs_packed_tags2_tags_only),
+				&tag_ecc);
+	}
+
+	unyaffs2_verify_ptags2(t, &pt2, ecc ? &tag_ecc : NULL);
+}
+
+/* inband tags: the tags part only, at the tail of the page, no ecc */
+static void
+unyaffs2_extract_ptags_inband (struct yaffs_ext_tags *t, unsigned char *tail,
+			       nand_ecclayout_t *ecclayout, int ecc)
+{
+	struct yaffs_packed_tags2 pt2;
+
+	memcpy(&pt2.t, tail, sizeof(struct yaffs_packed_tags2_tags_only));
+	unyaffs2_verify_ptags2(t, &pt2, NULL);
+}
+
+#ifdef _HAVE_MMAP
+/*
+ * tags of 'pages' consecutive chunks starting at 'offset', with the tags
+ * ecc of all of them calculated together.
+ */
+static void
+unyaffs2_extract_ptags_batch (struct yaffs_ext_tags *t, off_t offset,
+			      unsigned pages)
+{
+	unsigned i;
+	struct yaffs_packed_tags2 pt2[UNYAFFS2_TAGS_BATCH];
+	struct yaffs_ecc_other tag_ecc[UNYAFFS2_TAGS_BATCH];
+
+	if (UNYAFFS2_ISYAFFS1 || UNYAFFS2_ISINBAND) {
+		for (i = 0; i < pages; i++, offset += unyaffs2_bufsize)
+			unyaffs2_extract_ptags(&t[i],
+					       unyaffs2_page_spare(offset),
+					       NULL, 1);
+		return;
+	}
+
+	memset(pt2, 0xff, sizeof(struct yaffs_packed_tags2) * pages);
+	for (i = 0; i < pages; i++, offset += unyaffs2_bufsize) {
+		unyaffs2_spare2ptags((unsigned char *)&pt2[i],
+				     unyaffs2_page_spare(offset),
+				     sizeof(struct yaffs_packed_tags2),
+				     unyaffs2_ecclayout);
+	}
+
+	nand_ecc_calc_tags((unsigned char *)pt2,
+			   sizeof(struct yaffs_packed_tags2), pages, tag_ecc);
+
+	for (i = 0; i < pages; i++)
+		unyaffs2_verify_ptags2(&t[i], &pt2[i], &tag_ecc[i]);
+}
+#endif
+
 static inline int
 unyaffs2_isempty (unsigned char *buf, unsigned size)
 {
@@ -619,6 +766,141 @@ unyaffs2_isempty (unsigned char *buf, unsigned size)
 	return 1;
 }
 
+static inline int
+unyaffs2_isempty_page (unsigned char *data, unsigned char *spare)
+{
+	return unyaffs2_isempty(data, unyaffs2_chunksize) &&
+	       unyaffs2_isempty(spare, unyaffs2_sparesize);
+}
+
+#ifdef _HAVE_MMAP
+/* by the page map of the image if there is one, by the bytes if not */
+static inline int
+unyaffs2_isempty_at (off_t offset)
+{
+	if (unyaffs2_pagemap.bits)
+		return !page_map_test(&unyaffs2_pagemap,
+				      offset / unyaffs2_bufsize);
+
+	return unyaffs2_isempty_page(unyaffs2_page_data(offset),
+				     unyaffs2_page_spare(offset));
+}
+#endif
+
+/*----------------------------------------------------------------------------*/
+
+static inline void
+unyaffs2_ecc_stat (int result)
+{
+	if (result < 0)
+		unyaffs2_ecc_failed++;
+	else
+		unyaffs2_ecc_bits += result;
+}
+
+static inline void
+unyaffs2_ecc_stat_obj (struct unyaffs2_obj *obj, int result)
+{
+	if (result < 0)
+		obj->ecc_failed++;
+	else
+		obj->ecc_bits += result;
+}
+
+/*
+ * 'tmp' takes a copy of a syndrome page, put back as data and spare;
+ * 'page' is the index of the page in the image, for the randomizer.
+ */
+static inline int
+unyaffs2_correct_chunk (unsigned char *data, unsigned char *spare,
+			unsigned char *tmp, unsigned page)
+{
+	int result = 0;
+
+	if (unyaffs2_ecc.syndrome) {
+		memcpy(tmp, data, unyaffs2_chunksize);
+		memcpy(tmp + unyaffs2_chunksize, spare, unyaffs2_sparesize);
+		nand_ecc_deinterleave(&unyaffs2_ecc, tmp, data, spare);
+	}
+
+	if (unyaffs2_ecc.mode != NAND_ECC_NONE &&
+	    !unyaffs2_isempty_page(data, spare))
+		result = nand_ecc_correct(&unyaffs2_ecc, data, spare);
+
+	/* the ecc covers the randomized data, so it comes back after */
+	if (UNYAFFS2_ISSCRAMBLE)
+		scrambler_page(&unyaffs2_scrambler, page, data, spare,
+			       unyaffs2_sparesize);
+
+	return result;
+}
+
+#ifdef _HAVE_MMAP
+static void
+unyaffs2_correct_pages (void *arg, unsigned batch)
+{
+	unsigned page = batch * UNYAFFS2_ECC_BATCH;
+	unsigned end = page + UNYAFFS2_ECC_BATCH;
+	unsigned pages = *(unsigned *)arg;
+	unsigned char *tmp = NULL;
+	off_t offset;
+
+	if (end > pages)
+		end = pages;
+
+	if (unyaffs2_ecc.syndrome) {
+		tmp = malloc(unyaffs2_bufsize);
+		if (tmp == NULL) {
+			for (; page < end; page++)
+				unyaffs2_ecc_result[page] = -1;
+			return;
+		}
+	}
+
+	offset = (off_t)page * unyaffs2_bufsize;
+	for (; page < end; page++, offset += unyaffs2_bufsize) {
+		if (unyaffs2_pagemap.bits &&
+		    !page_map_test(&unyaffs2_pagemap, page))
+			continue;
+
+		unyaffs2_ecc_result[page] = unyaffs2_correct_chunk(
+			unyaffs2_page_data(offset),
+			unyaffs2_page_spare(offset), tmp, page);
+	}
+
+	free(tmp);
+}
+
+/*
+ * correct the whole (privately mapped) image up front, spread over the
+ * worker threads; the scan and the extraction then see clean data.
+ */
+static int
+unyaffs2_correct_img (void)
+{
+	unsigned i, pages = unyaffs2_mmapinfo.size / unyaffs2_bufsize;
+	struct thread_pool *pool = NULL;
+
+	unyaffs2_ecc_result = calloc(pages ? pages : 1, sizeof(int));
+	if (unyaffs2_ecc_result == NULL)
+		return -1;
+
+	if (unyaffs2_threads > 1)
+		pool = thread_pool_create(unyaffs2_threads);
+
+	thread_pool_run(pool, (pages + UNYAFFS2_ECC_BATCH - 1) /
+			UNYAFFS2_ECC_BATCH, unyaffs2_correct_pages, &pages);
+	thread_pool_destroy(pool);
+
+	for (i = 0; i < pages; i++)
+		unyaffs2_ecc_stat(unyaffs2_ecc_result[i]);
+
+	return 0;
+}
+#endif
+
+/*----------------------------------------------------------------------------*/
+
 static inline loff_t
 unyaffs2_extract_oh_size (struct yaffs_obj_hdr *oh)
 {
@@ -829,13 +1111,13 @@ unyaffs2_scan_img_status (unsigned status)
 }
 
 static int
-unyaffs2_scan_chunk (unsigned char *buffer, off_t offset)
+unyaffs2_scan_chunk (unsigned char *buffer, struct yaffs_ext_tags *t,
+		     off_t offset)
 {
 	struct yaffs_obj_hdr oh;
-	struct yaffs_ext_tags tag;
+	struct yaffs_ext_tags tag = *t;
 	struct unyaffs2_obj *obj;
 
-	unyaffs2_extract_ptags(&tag, buffer + unyaffs2_chunksize, NULL, 1);
 	if (tag.ecc_result == YAFFS_ECC_RESULT_UNFIXED) {
 		UNYAFFS2_DEBUG("invalid page skipped @ offset %lu\n", offset);
 		return 0;
@@ -849,6 +1131,11 @@ unyaffs2_scan_chunk (unsigned char *buffer, off_t offset)
 		return 0;
 	}
 
+	if (tag.seq_number == CHECKPT_SEQUENCE) {
+		UNYAFFS2_DEBUG("checkpoint page skipped @ offset %lu\n", offset);
+		return 0;
+	}
+
 	if (tag.chunk_id == 0) {
 	/* a new object */
 		obj = unyaffs2_objtable_find_alloc(tag.obj_id);
@@ -864,7 +1151,7 @@ unyaffs2_scan_chunk (unsigned char *buffer, off_t offset)
 			return -1;
 		}
 
-		memcpy(&oh, unyaffs2_databuf, sizeof(struct yaffs_obj_hdr));
+		memcpy(&oh, buffer, sizeof(struct yaffs_obj_hdr));
 		if (UNYAFFS2_ISENDIAN)
 			oh_endian_convert(&oh);
 
@@ -876,8 +1163,8 @@ unyaffs2_scan_chunk (unsigned char *buffer, off_t offset)
 
 		unyaffs2_image_objs++;
 	}
-	else if (tag.chunk_id == 1) {
-	/* the first data chunk of a object */
+	else {
+	/* a data chunk, which may follow a hole of a sparse file */
 		obj = unyaffs2_objtable_find_alloc(tag.obj_id);
 		if (obj == NULL) {
 			UNYAFFS2_ERROR("cannot allocate memory ");
@@ -886,17 +1173,70 @@ unyaffs2_scan_chunk (unsigned char *buffer, off_t offset)
 		}
 
 		obj->type = YAFFS_OBJECT_TYPE_FILE;
-		obj->variant.file.file_head = offset;
+		if (obj->variant.file.data_chunks++ == 0)
+			obj->variant.file.file_head = offset;
+		obj->variant.file.file_tail = offset;
 	}
 
 	return 0;
 }
 
+#ifdef _HAVE_MMAP
+/*
+ * Take the tags of the data chunks of a block out of its summary, as
+ * yaffs_summary_read() and yaffs_summary_fetch() do. Returns 0 if the
+ * block has no good summary.
+ */
+static unsigned
+unyaffs2_read_summary (off_t block)
+{
+	unsigned i, n = unyaffs2_summary_chunks;
+	off_t offset;
+	unsigned char *buf;
+	struct yaffs_ext_tags t;
+	struct summary_header hdr;
+	struct yaffs_packed_tags2_tags_only pt;
+
+	for (i = 0; n + i < unyaffs2_pages_per_block; i++) {
+		offset = block + (off_t)(n + i) * unyaffs2_bufsize;
+		buf = unyaffs2_page_data(offset);
+		unyaffs2_extract_ptags(&t, unyaffs2_page_spare(offset),
+				       NULL, 1);
+
+		if (t.obj_id != YAFFS_OBJECTID_SUMMARY ||
+		    t.chunk_id != i + 1 || t.chunk_used == 0 ||
+		    t.ecc_result > YAFFS_ECC_RESULT_FIXED ||
+		    summary_collect(unyaffs2_summary, n, &hdr, buf,
+				    unyaffs2_chunksize, i, t.n_bytes,
+				    UNYAFFS2_ISENDIAN))
+			return 0;
+	}
+
+	if (summary_check(unyaffs2_summary, n, &hdr, t.seq_number))
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		pt.seq_number = hdr.seq;
+		pt.obj_id = unyaffs2_summary[i].obj_id;
+		pt.chunk_id = unyaffs2_summary[i].chunk_id;
+		pt.n_bytes = unyaffs2_summary[i].n_bytes;
+		yaffs_unpack_tags2_tags_only(&unyaffs2_summary_tags[i], &pt);
+	}
+
+	return n;
+}
+#endif
+
 static int
 unyaffs2_scan_img (void)
 {
-#ifndef _HAVE_MMAP
+#ifdef _HAVE_MMAP
+	unsigned i, n, page;
+	unsigned char *data;
+	struct yaffs_ext_tags tags[UNYAFFS2_TAGS_BATCH];
+#else
 	ssize_t reads;
+	struct yaffs_ext_tags tag;
 #endif
 	off_t offset = 0, remains = 0;
 
@@ -910,15 +1250,57 @@ unyaffs2_scan_img (void)
 		UNYAFFS2_DEBUG("NULL mmap address.\n");
 		return 0;
 	}
-#endif
 
-#ifdef _HAVE_MMAP
 	remains = unyaffs2_mmapinfo.size;
-	while (offset < unyaffs2_mmapinfo.size && remains >= unyaffs2_bufsize &&
-	       memcpy(unyaffs2_databuf,
-		      unyaffs2_mmapinfo.addr + offset, unyaffs2_bufsize)) {
-		if (memcmp(unyaffs2_databuf, 
-		    unyaffs2_mmapinfo.addr + offset, unyaffs2_bufsize)) {
+	while (remains >= unyaffs2_bufsize) {
+		page = offset / unyaffs2_bufsize;
+
+		/* a block with a good summary needs no spares to be read */
+		n = 0;
+		if (unyaffs2_summary_chunks &&
+		    page % unyaffs2_pages_per_block == 0 &&
+		    remains >= unyaffs2_pages_per_block * unyaffs2_bufsize)
+			n = unyaffs2_read_summary(offset);
+
+		if (n) {
+			for (i = 0; i < n; i++) {
+				unyaffs2_scan_chunk(unyaffs2_page_data(offset),
+						    &unyaffs2_summary_tags[i],
+						    offset);
+				offset += unyaffs2_bufsize;
+			}
+
+			/* and the summary itself */
+			offset += (unyaffs2_pages_per_block - n) *
+				  unyaffs2_bufsize;
+			remains -= unyaffs2_pages_per_block * unyaffs2_bufsize;
+			unyaffs2_summary_blocks++;
+			continue;
+		}
+
+		n = remains / unyaffs2_bufsize;
+		if (n > UNYAFFS2_TAGS_BATCH)
+			n = UNYAFFS2_TAGS_BATCH;
+
+		/* stay within the block, so the next one starts afresh */
+		if (unyaffs2_pages_per_block &&
+		    n > unyaffs2_pages_per_block -
+			page % unyaffs2_pages_per_block)
+			n = unyaffs2_pages_per_block -
+			    page % unyaffs2_pages_per_block;
+
+		/* tags of a block's worth of spares are checked at once */
+		unyaffs2_extract_ptags_batch(tags, offset, n);
+
+		for (i = 0; i < n; i++) {
+			data = unyaffs2_page_data(offset);
+			if (!unyaffs2_isempty_at(offset))
+				unyaffs2_scan_chunk(data, &tags[i], offset);
+
+			offset += unyaffs2_bufsize;
+			remains -= unyaffs2_bufsize;
+		}
+	}
 #else
 	remains = lseek(unyaffs2_image_fd, 0, SEEK_END);
 	offset = lseek(unyaffs2_image_fd, 0, SEEK_SET);
@@ -926,19 +1308,25 @@ unyaffs2_scan_img (void)
 	       (reads = safe_read(unyaffs2_image_fd,
 		unyaffs2_databuf, unyaffs2_bufsize)) != 0) {
 		if (reads != unyaffs2_bufsize) {
-#endif
 			/* parse image failed */
 			UNYAFFS2_ERROR("read image failed @ offset %lu.",
 					offset);
 			return -1;
 		}
 
-		if (!unyaffs2_isempty(unyaffs2_databuf, unyaffs2_bufsize))
-			unyaffs2_scan_chunk(unyaffs2_databuf, offset);
+		unyaffs2_ecc_stat(unyaffs2_correct_chunk(unyaffs2_databuf,
+				  unyaffs2_databuf + unyaffs2_chunksize,
+				  unyaffs2_physbuf, offset / unyaffs2_bufsize));
+		if (!unyaffs2_isempty(unyaffs2_databuf, unyaffs2_bufsize)) {
+			unyaffs2_extract_ptags(&tag, unyaffs2_databuf +
+					       unyaffs2_chunksize, NULL, 1);
+			unyaffs2_scan_chunk(unyaffs2_databuf, &tag, offset);
+		}
 
 		offset += unyaffs2_bufsize;
 		remains -= unyaffs2_bufsize;
 	}
+#endif
 
 	return 0;
 }
@@ -1037,13 +1425,15 @@ unyaffs2_build_objtree (void)
 
 #ifdef _HAVE_MMAP
 static int
-unyaffs2_extract_file_mmap (unsigned char *addr, size_t size, const char *fpath,
-			    struct unyaffs2_obj *obj)
+unyaffs2_extract_file_mmap (const char *fpath, struct unyaffs2_obj *obj)
 {
-	int outfd;
-	unsigned char *outaddr, *curaddr, *endaddr = addr + size;
+	int outfd, retval = -1;
+	unsigned chunks = obj->variant.file.data_chunks;
+	unsigned char *outaddr;
+	off_t offset, end;
 	size_t bufsize = unyaffs2_chunksize + unyaffs2_sparesize;
-	size_t fsize = obj->variant.file.file_size, remains = 0, written = 0;
+	size_t fsize = obj->variant.file.file_size, written = 0;
+	loff_t pos;
 
 	struct yaffs_ext_tags tag;
 
@@ -1054,8 +1444,10 @@ unyaffs2_extract_file_mmap (unsigned char *addr, size_t size, const char *fpath,
 		return -1;
 	}
 
-	if (fsize == 0)
+	if (fsize == 0) {
+		retval = 0;
 		goto out;
+	}
 
 	/* stretch the file */
 	if (lseek(outfd, fsize - 1, SEEK_SET) < 0 ||
@@ -1074,46 +1466,63 @@ unyaffs2_extract_file_mmap (unsigned char *addr, size_t size, const char *fpath,
 		goto out;
 	}
 
-	if (obj->variant.file.file_head == ~(off_t)0) {
-		UNYAFFS2_DEBUG("invalid head offset of file  '%s'\n", fpath);
-		goto out;
+	if (obj->variant.file.file_tail >= unyaffs2_mmapinfo.size) {
+		UNYAFFS2_DEBUG("invalid tail offset of file  '%s'\n", fpath);
+		goto unmap;
 	}
 
-	addr += obj->variant.file.file_head;
-	curaddr = outaddr;
-	remains = fsize;
+	end = obj->variant.file.file_tail + bufsize;
+	offset = obj->variant.file.file_head;
 
-	while (addr < endaddr && remains > 0) {
-		unyaffs2_extract_ptags(&tag, addr + unyaffs2_chunksize,
+	/* every chunk goes by its chunk_id, the holes stay zeros */
+	while (offset < end && chunks > 0) {
+		unyaffs2_extract_ptags(&tag, unyaffs2_page_spare(offset),
 				       NULL, 0);
 
-		written = remains < tag.n_bytes ? remains : tag.n_bytes;
-		memcpy(curaddr, addr, written);
-		if (memcmp(curaddr, addr, written)) {
-			UNYAFFS2_DEBUG("copy file failed '%s': %s\n",
-					fpath, strerror(errno));
+		/* summary or checkpoint chunks in between */
+		if (tag.obj_id != obj->obj_id) {
+			offset += bufsize;
+			continue;
+		}
+
+		/* only the chunks of the file count for it */
+		if (unyaffs2_ecc_result) {
+			unyaffs2_ecc_stat_obj(obj,
+				unyaffs2_ecc_result[offset / bufsize]);
+		}
+
+		pos = (loff_t)(tag.chunk_id - 1) * unyaffs2_chunksize;
+		if (tag.chunk_id == 0 || pos >= fsize) {
+			UNYAFFS2_DEBUG("chunk %u beyond the end of file '%s'\n",
+					tag.chunk_id, fpath);
 			break;
 		}
 
-		remains -= written;
-		curaddr += written;
-		addr += bufsize;
+		written = fsize - pos < tag.n_bytes ? fsize - pos : tag.n_bytes;
+		memcpy(outaddr + pos, unyaffs2_page_data(offset), written);
+
+		chunks--;
+		offset += bufsize;
 	}
 
+	if (chunks == 0)
+		retval = 0;
+unmap:
 	munmap(outaddr, fsize);
 out:
 	close(outfd);
 
-	return !(remains == 0);
+	return retval;
 }
 #else
 static int
 unyaffs2_extract_file (const int fd, const char *fpath,
 		       struct unyaffs2_obj *obj)
 {
-	int outfd;
+	int outfd, result;
 	size_t written = 0, size = obj->variant.file.file_size;
 	ssize_t w, r;
+	off_t offset = obj->variant.file.file_head;
 
 	struct yaffs_ext_tags tag;
 
@@ -1144,10 +1553,18 @@ unyaffs2_extract_file (const int fd, const char *fpath,
 			break;
 		}
 
+		result = unyaffs2_correct_chunk(unyaffs2_databuf,
+				unyaffs2_databuf + unyaffs2_chunksize,
+				unyaffs2_physbuf, offset / unyaffs2_bufsize);
+		offset += unyaffs2_bufsize;
 		unyaffs2_extract_ptags(&tag,
 				       unyaffs2_databuf + unyaffs2_chunksize,
 				       NULL, 0);
 
+		/* only the chunks of the file count for it */
+		if (tag.obj_id == obj->obj_id)
+			unyaffs2_ecc_stat_obj(obj, result);
+
 		w = safe_write(outfd, unyaffs2_databuf, tag.n_bytes);
 		if (w != tag.n_bytes) {
 			UNYAFFS2_DEBUG("write file failed '%s': %s",
@@ -1173,7 +1590,7 @@ unyaffs2_extract_hardlink (const char *fpath, struct unyaffs2_obj *obj)
 	char *lnkfile;
 
 	struct unyaffs2_obj *equiv;
-	union unyaffs2_file_variant *variant;
+	union unyaffs2_file_variant variant;
 
 	equiv = unyaffs2_follow_hardlink(obj);
 	if (equiv == NULL) {
@@ -1274,9 +1691,7 @@ unyaffs2_extract_obj (const char *fpath, struct unyaffs2_obj *obj)
 	case YAFFS_OBJECT_TYPE_FILE:
 		retval =
 #ifdef _HAVE_MMAP
-		unyaffs2_extract_file_mmap(unyaffs2_mmapinfo.addr,
-					   unyaffs2_mmapinfo.size,
-					   fpath, obj);
+		unyaffs2_extract_file_mmap(fpath, obj);
 #else
 		unyaffs2_extract_file(unyaffs2_image_fd,
 				      fpath, obj);
@@ -1352,11 +1767,7 @@ unyaffs2_extract_objtree (struct unyaffs2_obj *obj)
 	 * extract the object content
 	 */
 #ifdef _HAVE_MMAP
-	memcpy(unyaffs2_databuf, unyaffs2_mmapinfo.addr + obj->hdr_off,
-	       unyaffs2_bufsize);
-
-	if (memcmp(unyaffs2_databuf, unyaffs2_mmapinfo.addr + obj->hdr_off,
-	    unyaffs2_bufsize)) {
+	if (obj->hdr_off + unyaffs2_bufsize > unyaffs2_mmapinfo.size) {
 #else
 	lseek(unyaffs2_image_fd, obj->hdr_off, SEEK_SET);
 	reads = safe_read(unyaffs2_image_fd,
@@ -1370,6 +1781,17 @@ unyaffs2_extract_objtree (struct unyaffs2_obj *obj)
 		return -1;
 	}
 
+#ifdef _HAVE_MMAP
+	memcpy(unyaffs2_databuf, unyaffs2_page_data(obj->hdr_off),
+	       unyaffs2_chunksize);
+	memcpy(unyaffs2_databuf + unyaffs2_chunksize,
+	       unyaffs2_page_spare(obj->hdr_off), unyaffs2_sparesize);
+#else
+	unyaffs2_correct_chunk(unyaffs2_databuf,
+			       unyaffs2_databuf + unyaffs2_chunksize,
+			       unyaffs2_physbuf, obj->hdr_off / unyaffs2_bufsize);
+#endif
+
 	memcpy(&oh, unyaffs2_databuf, sizeof(struct yaffs_obj_hdr));
 	if (UNYAFFS2_ISENDIAN)
 		oh_endian_convert(&oh);
@@ -1415,6 +1837,18 @@ unyaffs2_extract_objtree (struct unyaffs2_obj *obj)
 	if (dstfile)
 		retval = unyaffs2_extract_obj(dstfile, obj);
 
+	if (obj->ecc_failed) {
+		UNYAFFS2_WARN("\rwarning: '%s': %u uncorrectable chunks "
+			      "(%u bitflips corrected).\n", unyaffs2_curfile,
+			      obj->ecc_failed, obj->ecc_bits);
+		unyaffs2_ecc_broken++;
+	}
+	else if (obj->ecc_bits) {
+		UNYAFFS2_VERBOSE("\r'%s': %u bitflips corrected.\n",
+				 unyaffs2_curfile, obj->ecc_bits);
+		unyaffs2_ecc_files++;
+	}
+
 next:
 	if (retval) {
 		UNYAFFS2_ERROR("object %u: [%4s] '%s' (FAILED).\n",
@@ -1481,6 +1915,34 @@ unyaffs2_load_spare (const char *oobfile)
 
 /*----------------------------------------------------------------------------*/
 
+#ifdef _HAVE_MMAP
+static int
+unyaffs2_load_pagemap (const char *mapfile)
+{
+	int fd, retval;
+
+	fd = open(mapfile, O_RDONLY);
+	if (fd < 0) {
+		UNYAFFS2_ERROR("cannot open the page map: '%s'\n", mapfile);
+		return -1;
+	}
+
+	retval = page_map_load(&unyaffs2_pagemap, fd);
+	close(fd);
+
+	if (retval < 0 || unyaffs2_pagemap.page_sz != unyaffs2_bufsize ||
+	    unyaffs2_pagemap.pages != unyaffs2_mmapinfo.size /
+				      unyaffs2_bufsize) {
+		UNYAFFS2_ERROR("'%s' is NOT the page map of the image.\n",
+				mapfile);
+		page_map_release(&unyaffs2_pagemap);
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+
 static int
 unyaffs2_extract_image (const char *imgfile, const char *dirpath)
 {
@@ -1502,14 +1964,18 @@ unyaffs2_extract_image (const char *imgfile, const char *dirpath)
 		goto free_and_out;
 	}
 
-	if ((statbuf.st_size % (unyaffs2_chunksize + unyaffs2_sparesize)) != 0)
+	if (unyaffs2_sparefile == NULL &&
+	    (statbuf.st_size % (unyaffs2_chunksize + unyaffs2_sparesize)) != 0)
 		UNYAFFS2_WARN("warning: image size (%lu)"
 			      "is NOT a multiple of (%u + %u).\n",
 			      statbuf.st_size, unyaffs2_chunksize,
 			      unyaffs2_sparesize);
 
 #if _HAVE_MMAP
-	unyaffs2_mmapinfo.addr = mmap(NULL, statbuf.st_size, PROT_READ,
+	/* corrections go to private copies of the pages, never to the file */
+	unyaffs2_mmapinfo.addr = mmap(NULL, statbuf.st_size, PROT_READ |
+				      (unyaffs2_ecc.mode != NAND_ECC_NONE ||
+				       UNYAFFS2_ISSCRAMBLE ? PROT_WRITE : 0),
 				      MAP_PRIVATE, unyaffs2_image_fd, 0);
 	if (unyaffs2_mmapinfo.addr == MAP_FAILED) {
 		UNYAFFS2_ERROR("mapping image failed: %s\n", strerror(errno));
@@ -1517,17 +1983,78 @@ unyaffs2_extract_image (const char *imgfile, const char *dirpath)
 	}
 
 	unyaffs2_mmapinfo.size = statbuf.st_size;
+
+	/* split spares: the image reads as if the two were interleaved */
+	if (unyaffs2_sparefile) {
+		off_t pages = statbuf.st_size / unyaffs2_chunksize;
+
+		unyaffs2_spare_fd = open(unyaffs2_sparefile, O_RDONLY);
+		if (unyaffs2_spare_fd < 0 ||
+		    fstat(unyaffs2_spare_fd, &statbuf) < 0 ||
+		    !S_ISREG(statbuf.st_mode)) {
+			UNYAFFS2_ERROR("cannot open the spare file: '%s'\n",
+					unyaffs2_sparefile);
+			goto free_and_out;
+		}
+
+		if (statbuf.st_size != pages * unyaffs2_sparesize)
+			UNYAFFS2_WARN("warning: spare file size (%lu) does "
+				      "NOT match %lu pages of %u bytes.\n",
+				      statbuf.st_size, pages,
+				      unyaffs2_sparesize);
+
+		if (statbuf.st_size < pages * unyaffs2_sparesize)
+			pages = statbuf.st_size / unyaffs2_sparesize;
+
+		unyaffs2_mmapinfo.spare = mmap(NULL, statbuf.st_size,
+					       PROT_READ |
+					       (unyaffs2_ecc.mode !=
+						NAND_ECC_NONE ||
+						UNYAFFS2_ISSCRAMBLE ?
+						PROT_WRITE : 0),
+					       MAP_PRIVATE, unyaffs2_spare_fd,
+					       0);
+		if (unyaffs2_mmapinfo.spare == MAP_FAILED) {
+			unyaffs2_mmapinfo.spare = NULL;
+			UNYAFFS2_ERROR("mapping spare file failed: %s\n",
+					strerror(errno));
+			goto free_and_out;
+		}
+
+		unyaffs2_mmapinfo.sparesize = statbuf.st_size;
+		unyaffs2_mmapinfo.size = pages * (unyaffs2_chunksize +
+						  unyaffs2_sparesize);
+	}
 #endif
 
 	unyaffs2_bufsize = unyaffs2_chunksize + unyaffs2_sparesize;
 	unyaffs2_databuf = (unsigned char *)malloc(unyaffs2_bufsize);
-	if (unyaffs2_databuf == NULL) {
+	unyaffs2_physbuf = (unsigned char *)malloc(unyaffs2_bufsize);
+	if (unyaffs2_databuf == NULL || unyaffs2_physbuf == NULL) {
 		UNYAFFS2_ERROR("cannot allocate working buffer (%u bytes): %s",
 				unyaffs2_chunksize + unyaffs2_sparesize,
 				strerror(errno));
 		goto free_and_out;
 	}
 
+#ifdef _HAVE_MMAP
+	if (unyaffs2_summary_chunks) {
+		unyaffs2_summary = calloc(unyaffs2_summary_chunks,
+					  sizeof(struct summary_tags));
+		unyaffs2_summary_tags = calloc(unyaffs2_summary_chunks,
+					sizeof(struct yaffs_ext_tags));
+		if (unyaffs2_summary == NULL || unyaffs2_summary_tags == NULL) {
+			UNYAFFS2_ERROR("cannot allocate the summary: %s\n",
+					strerror(errno));
+			goto free_and_out;
+		}
+	}
+
+	/* the page map of mkyaffs2 tells the erased pages at once */
+	if (unyaffs2_mapfile && unyaffs2_load_pagemap(unyaffs2_mapfile) < 0)
+		goto free_and_out;
+#endif
+
 	umask(0);
 
 	if (unyaffs2_mkdir(dirpath, 0755) < 0 || chdir(dirpath) < 0 ||
@@ -1542,6 +2069,22 @@ unyaffs2_extract_image (const char *imgfile, const char *dirpath)
 
 	unyaffs2_objtable_insert(root);
 
+#ifdef _HAVE_MMAP
+	/* stage 0: correcting the data by its ecc, and descrambling it */
+	if (unyaffs2_ecc.mode != NAND_ECC_NONE || UNYAFFS2_ISSCRAMBLE) {
+		UNYAFFS2_PRINTF("\n");
+		UNYAFFS2_PRINTF("correcting image '%s'... [*]", imgfile);
+
+		if (unyaffs2_correct_img() < 0) {
+			UNYAFFS2_ERROR("\ncannot allocate ecc results: %s\n",
+					strerror(errno));
+			goto exit_and_out;
+		}
+
+		UNYAFFS2_PRINTF("\b\b\b[done]\n");
+	}
+#endif
+
 	/* stage 1: scanning image */
 	UNYAFFS2_PRINTF("\n");
 	UNYAFFS2_PRINTF("scanning image '%s'... [*]", imgfile);
@@ -1552,6 +2095,19 @@ unyaffs2_extract_image (const char *imgfile, const char *dirpath)
 	UNYAFFS2_PRINTF("\b\b\b[done]\nscanning complete, total objects: %d\n",
 			unyaffs2_image_objs);
 
+#ifdef _HAVE_MMAP
+	if (unyaffs2_summary_chunks) {
+		UNYAFFS2_PRINTF("%u blocks scanned by their summary\n",
+				unyaffs2_summary_blocks);
+	}
+#endif
+
+	if (unyaffs2_ecc.mode != NAND_ECC_NONE) {
+		UNYAFFS2_PRINTF("ecc: %u bitflips corrected, "
+				"%u pages uncorrectable\n",
+				unyaffs2_ecc_bits, unyaffs2_ecc_failed);
+	}
+
 	UNYAFFS2_PRINTF("\n");
 	UNYAFFS2_PRINTF("building fs tree ... [*]");
 	if (unyaffs2_build_objtree() < 0) {
@@ -1601,14 +2157,144 @@ unyaffs2_extract_image (const char *imgfile, const char *dirpath)
 	if (!retval)
 		UNYAFFS2_PRINTF("\b\b\b[done]\n");
 
+	if (unyaffs2_ecc.mode != NAND_ECC_NONE) {
+		UNYAFFS2_PRINTF("ecc: %u files corrected, %u files with "
+				"uncorrectable data\n",
+				unyaffs2_ecc_files, unyaffs2_ecc_broken);
+	}
+
 exit_and_out:
 	unyaffs2_objtree_exit(&unyaffs2_objtree);
 	unyaffs2_objtable_exit();
 free_and_out:
 	if (unyaffs2_image_fd >= 0)
 		close(unyaffs2_image_fd);
+	if (unyaffs2_spare_fd >= 0)
+		close(unyaffs2_spare_fd);
 	if (unyaffs2_databuf)
 		free(unyaffs2_databuf);
+	free(unyaffs2_physbuf);
+#ifdef _HAVE_MMAP
+	free(unyaffs2_ecc_result);
+	unyaffs2_ecc_result = NULL;
+	free(unyaffs2_summary_tags);
+	free(unyaffs2_summary);
+	page_map_release(&unyaffs2_pagemap);
+#endif
+
+	return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/* a page read raw from the device which differs from the image */
+static int
+unyaffs2_verify_correct (void *arg, unsigned char *page)
+{
+	return nand_ecc_correct(&unyaffs2_ecc, page, page + unyaffs2_chunksize);
+}
+
+static void
+unyaffs2_verify_report (void *arg, unsigned block, unsigned devblock)
+{
+	UNYAFFS2_ERROR("block %u of the image (device block %u) "
+		       "does NOT match.\n", block, devblock);
+}
+
+static void
+unyaffs2_verify_progress (unsigned blocks, unsigned total)
+{
+	UNYAFFS2_PROGRESS_BAR(blocks, total);
+}
+
+/*
+ * Check the device (or a dump of it) programmed by "mkyaffs2 --mtd" with
+ * the same options against the image, block by block.
+ */
+static int
+unyaffs2_verify_image (const char *imgfile, const char *devpath)
+{
+	int fd, raw, retval = -1;
+	unsigned pagesize, oobsize;
+	struct stat statbuf;
+	struct mtd_dev dev;
+	struct mtd_verify v;
+
+	unyaffs2_bufsize = unyaffs2_chunksize + unyaffs2_sparesize;
+
+	fd = open(imgfile, O_RDONLY);
+	if (fd < 0 || fstat(fd, &statbuf) < 0 || !S_ISREG(statbuf.st_mode)) {
+		UNYAFFS2_ERROR("cannot open the image file: '%s'\n", imgfile);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	if (statbuf.st_size % unyaffs2_bufsize) {
+		UNYAFFS2_ERROR("image size (%lu) is NOT a multiple of "
+			       "(%u + %u).\n", statbuf.st_size,
+			       unyaffs2_chunksize, unyaffs2_sparesize);
+		goto close_and_out;
+	}
+
+	/* the stream of pages as mkyaffs2 programmed them */
+	pagesize = UNYAFFS2_ISINBAND ? unyaffs2_bufsize : unyaffs2_chunksize;
+	oobsize = UNYAFFS2_ISINBAND ? unyaffs2_bufsize / 32 : unyaffs2_sparesize;
+	raw = unyaffs2_ecc.mode != NAND_ECC_NONE;
+
+	if (mtd_dev_open(&dev, devpath, pagesize, oobsize,
+			 unyaffs2_pages_per_block) < 0) {
+		UNYAFFS2_ERROR("cannot open the mtd device '%s' (a dump needs "
+			       "'--pages-per-block' or 'ppb=', and whole "
+			       "blocks): %s\n", devpath, strerror(errno));
+		goto close_and_out;
+	}
+
+	if (dev.writesize != pagesize ||
+	    (!UNYAFFS2_ISINBAND && dev.oobsize < unyaffs2_sparesize) ||
+	    (unyaffs2_pages_per_block &&
+	     unyaffs2_pages_per_block != dev.pages_per_block)) {
+		UNYAFFS2_ERROR("mtd device '%s' of %u + %u bytes pages and "
+			       "%u pages per block does NOT match.\n",
+			       devpath, dev.writesize, dev.oobsize,
+			       dev.pages_per_block);
+		goto release_and_out;
+	}
+
+	if (mtd_verify_start(&v, &dev, pagesize,
+			     UNYAFFS2_ISINBAND ? 0 : unyaffs2_sparesize, raw,
+			     unyaffs2_ecclayout) < 0) {
+		UNYAFFS2_ERROR("cannot set up the verification: %s\n",
+			       strerror(errno));
+		goto release_and_out;
+	}
+
+	if (raw)
+		v.correct = unyaffs2_verify_correct;
+	v.report = unyaffs2_verify_report;
+
+	UNYAFFS2_PRINTF("verifying '%s' against '%s' (crc32c: %s)\n",
+			devpath, imgfile, crc32c_name());
+	UNYAFFS2_PROGRESS_INIT();
+
+	if (mtd_verify_image(&v, fd, statbuf.st_size / unyaffs2_bufsize,
+			     unyaffs2_verify_progress) < 0) {
+		UNYAFFS2_ERROR("\ncannot read the device '%s': %s\n",
+			       devpath, strerror(errno));
+		goto verify_and_out;
+	}
+
+	UNYAFFS2_PRINTF("\n%u blocks verified, %u bad blocks skipped, "
+			"%u bitflips corrected, %u blocks NOT matching.\n",
+			v.blocks, v.bad, v.corrected, v.mismatched);
+	retval = v.mismatched ? -1 : 0;
+
+verify_and_out:
+	mtd_verify_release(&v);
+release_and_out:
+	mtd_dev_close(&dev);
+close_and_out:
+	close(fd);
 
 	return retval;
 }
@@ -1622,6 +2308,12 @@ unyaffs2_helper (void)
 	UNYAFFS2_HELP("Usage: unyaffs2 [-h|--help] [-e|--endian] [-v|--verbose]\n"
 		      "                [-p|--pagesize pagesize] [-s|--sparesize sparesize]\n"
 		      "                [-o|--oobimg oobimage] [-f|--fileset file] [--yaffs-ecclayout]\n"
+		      "                [--ecc hamming|bch] [--ecc-strength bits] [--ecc-step bytes]\n"
+		      "                [-j|--jobs threads] [--pages-per-block pages]\n"
+		      "                [--inband-tags] [--split-spare sparefile]\n"
+		      "                [--syndrome] [--syndrome-pad prepad,postpad]\n"
+		      "                [--scramble seed] [--scramble-period pages]\n"
+		      "                [--page-map mapfile] [--verify devfile]\n"
 		      "                imgfile dirname\n\n");
 	UNYAFFS2_HELP("Options :\n");
 	UNYAFFS2_HELP("  -h                 display this help message and exit.\n");
@@ -1634,6 +2326,24 @@ unyaffs2_helper (void)
 	UNYAFFS2_HELP("  -o oobimage        load external oob image file.\n");;
 	UNYAFFS2_HELP("  -f file            extract the specified file selection.\n");;
 	UNYAFFS2_HELP("  --yaffs-ecclayout  use yaffs oob scheme instead of the Linux MTD default.\n");
+	UNYAFFS2_HELP("  --ecc hamming|bch  correct the data by the Linux MTD software ecc in eccpos.\n");
+	UNYAFFS2_HELP("  --ecc-strength     bch: bit errors corrected per step (default: %u).\n",
+		      NAND_ECC_BCH_STRENGTH);
+	UNYAFFS2_HELP("  --ecc-step         bch: data bytes per ecc step (default: %u).\n",
+		      NAND_ECC_BCH_STEP);
+	UNYAFFS2_HELP("  -j threads         worker threads for the ecc (default: online cpus).\n");
+	UNYAFFS2_HELP("  --pages-per-block  pages per erase block, to scan by the block summaries.\n");
+	UNYAFFS2_HELP("  --inband-tags      tags at the tail of every page, no oob in the image.\n");
+	UNYAFFS2_HELP("  --split-spare      imgfile of the data areas, the spares in sparefile.\n");
+	UNYAFFS2_HELP("  --syndrome         the ecc of every step right after its data.\n");
+	UNYAFFS2_HELP("  --syndrome-pad     spare bytes before and after every ecc (default: 0,0).\n");
+	UNYAFFS2_HELP("  --scramble         derandomize the data of every page from the prbs15 seed.\n");
+	UNYAFFS2_HELP("  --scramble-period  pages before the keystreams repeat\n"
+		      "                     (default: pages-per-block, or %u).\n",
+		      SCRAMBLER_PERIOD);
+	UNYAFFS2_HELP("  --page-map         the pages not erased by the bitmap of mkyaffs2.\n");
+	UNYAFFS2_HELP("  --verify           check the mtd device (or a dump) against imgfile,\n"
+		      "                     instead of extracting it (no dirname).\n");
 
 	return -1;
 }
@@ -1647,7 +2357,7 @@ main (int argc, char* argv[])
 	char *imgfile = NULL, *dirpath = NULL, *oobfile = NULL;
 
 	int option, option_index;
-	static const char *short_options = "hvep:s:o:f:";
+	static const char *short_options = "hvep:s:o:f:j:";
 	static const struct option long_options[] = {
 		{"pagesize",		required_argument, 	0, 'p'},
 		{"sparesize",		required_argument,	0, 's'},
@@ -1656,11 +2366,29 @@ main (int argc, char* argv[])
 		{"endian",		no_argument, 		0, 'e'},
 		{"verbose",		no_argument,	 	0, 'v'},
 		{"yaffs-ecclayout",	no_argument,	 	0, 'y'},
+		{"ecc",			required_argument,	0, 'E'},
+		{"ecc-strength",	required_argument,	0, 'T'},
+		{"ecc-step",		required_argument,	0, 'P'},
+		{"jobs",		required_argument,	0, 'j'},
+		{"pages-per-block",	required_argument,	0, 'B'},
+		{"inband-tags",		no_argument,		0, 'I'},
+		{"split-spare",		required_argument,	0, 'O'},
+		{"syndrome",		no_argument,		0, 'Y'},
+		{"syndrome-pad",	required_argument,	0, 'V'},
+		{"scramble",		required_argument,	0, 'R'},
+		{"scramble-period",	required_argument,	0, 'Q'},
+		{"page-map",		required_argument,	0, 'M'},
+		{"verify",		required_argument,	0, 'C'},
 		{"help",		no_argument, 		0, 'h'},
 		{NULL,			no_argument,		0, '\0'},
 	};
 
+	unsigned ecc_mode = NAND_ECC_NONE;
+	unsigned ecc_step = 0, ecc_strength = 0;
+	unsigned prepad = 0, postpad = 0;
+
 	unyaffs2_chunksize = DEFAULT_CHUNKSIZE;
+	unyaffs2_threads = thread_pool_cpus();
 
 	while ((option = getopt_long(argc, argv, short_options,
 				     long_options, &option_index)) != EOF) 
@@ -1693,13 +2421,61 @@ main (int argc, char* argv[])
 		case 'y':
 			unyaffs2_flags |= UNYAFFS2_FLAGS_YAFFSECC;
 			break;
+		case 'E':
+			if (!strcmp(optarg, "hamming"))
+				ecc_mode = NAND_ECC_HAMMING;
+			else if (!strcmp(optarg, "bch"))
+				ecc_mode = NAND_ECC_BCH;
+			else if (!strcmp(optarg, "none"))
+				ecc_mode = NAND_ECC_NONE;
+			else
+				return unyaffs2_helper();
+			break;
+		case 'T':
+			ecc_strength = strtoul(optarg, NULL, 10);
+			break;
+		case 'P':
+			ecc_step = strtoul(optarg, NULL, 10);
+			break;
+		case 'j':
+			unyaffs2_threads = strtoul(optarg, NULL, 10);
+			break;
+		case 'B':
+			unyaffs2_pages_per_block = strtoul(optarg, NULL, 10);
+			break;
+		case 'I':
+			unyaffs2_flags |= UNYAFFS2_FLAGS_INBAND;
+			break;
+		case 'O':
+			unyaffs2_sparefile = optarg;
+			break;
+		case 'Y':
+			unyaffs2_flags |= UNYAFFS2_FLAGS_SYNDROME;
+			break;
+		case 'V':
+			if (sscanf(optarg, "%u,%u", &prepad, &postpad) != 2)
+				return unyaffs2_helper();
+			break;
+		case 'R':
+			unyaffs2_flags |= UNYAFFS2_FLAGS_SCRAMBLE;
+			unyaffs2_scramble_seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'Q':
+			unyaffs2_scramble_period = strtoul(optarg, NULL, 10);
+			break;
+		case 'M':
+			unyaffs2_mapfile = optarg;
+			break;
+		case 'C':
+			unyaffs2_verify_path = optarg;
+			break;
 		case 'h':
 		default:
 			return unyaffs2_helper();
 		}
 	}
 
-	if (argc - optind < 2)
+	if (argc - optind < (unyaffs2_verify_path ? 1 : 2))
 		return unyaffs2_helper();
 
 	imgfile = argv[optind];
@@ -1753,17 +2529,119 @@ main (int argc, char* argv[])
 		return -1;
 	}
 
+	/* inband tags: the tail of the page stands for the spare */
+	if (UNYAFFS2_ISINBAND) {
+		if (UNYAFFS2_ISYAFFS1 || oobfile || unyaffs2_sparesize ||
+		    ecc_mode != NAND_ECC_NONE) {
+			UNYAFFS2_ERROR("inband tags need a yaffs2 image "
+				       "without oob or ecc options.\n");
+			return -1;
+		}
+		unyaffs2_sparesize = sizeof(struct yaffs_packed_tags2_tags_only);
+		unyaffs2_chunksize -= unyaffs2_sparesize;
+		unyaffs2_extract_ptags = &unyaffs2_extract_ptags_inband;
+	}
+
 	/* spare size */
 	if (!unyaffs2_sparesize)
 		unyaffs2_sparesize = unyaffs2_chunksize / 32;
 
+	/* the spares of a split image are read from their own file */
+	if (unyaffs2_sparefile) {
+		if (unyaffs2_verify_path) {
+			UNYAFFS2_ERROR("verify needs the spares in imgfile.\n");
+			return -1;
+		}
+#ifdef _HAVE_MMAP
+		if (UNYAFFS2_ISINBAND) {
+			UNYAFFS2_ERROR("inband tags have no spare file.\n");
+			return -1;
+		}
+#else
+		UNYAFFS2_ERROR("split spare needs mmap (_HAVE_MMAP).\n");
+		return -1;
+#endif
+	}
+
+	/* a syndrome page covers the bad block marker with its data */
+	if (unyaffs2_verify_path && UNYAFFS2_ISSYNDROME) {
+		UNYAFFS2_ERROR("syndrome pages cannot be verified, their "
+			       "bad block markers are data.\n");
+		return -1;
+	}
+
 	if (unyaffs2_sparesize > unyaffs2_chunksize) {
 		UNYAFFS2_ERROR("spare size is too large (%u).\n",
 				unyaffs2_sparesize);
 		return -1;
 	}
 
+#ifdef _HAVE_MMAP
+	/* the data chunks of a block come before its summary */
+	if (!UNYAFFS2_ISYAFFS1 && unyaffs2_pages_per_block)
+		unyaffs2_summary_chunks = summary_chunks(unyaffs2_chunksize,
+						unyaffs2_pages_per_block);
+#endif
+
+	/* software ecc of the data area, laid out as mkyaffs2 does */
+	if (nand_ecc_setup(&unyaffs2_ecc, ecc_mode, ecc_step, ecc_strength,
+			   unyaffs2_chunksize, unyaffs2_sparesize,
+			   unyaffs2_ecclayout) < 0) {
+		UNYAFFS2_ERROR("ecc does NOT fit in the %u bytes spare.\n",
+				unyaffs2_sparesize);
+		return -1;
+	}
+
+	/* the tags go where the ecc left room, in a copy of the layout */
+	unyaffs2_ecclayout = &unyaffs2_ecc.layout;
+
+	/* ecc after every step of data, the tags in the rest of the oob */
+	if (UNYAFFS2_ISSYNDROME) {
+		if (ecc_mode == NAND_ECC_NONE ||
+		    nand_ecc_syndrome(&unyaffs2_ecc, prepad, postpad,
+				      unyaffs2_sparesize,
+				      &unyaffs2_syndrome_layout) < 0) {
+			UNYAFFS2_ERROR("syndrome layout needs '--ecc', "
+				       "fitting with its pads in the "
+				       "%u bytes spare.\n",
+				       unyaffs2_sparesize);
+			nand_ecc_release(&unyaffs2_ecc);
+			return -1;
+		}
+		unyaffs2_ecclayout = &unyaffs2_syndrome_layout;
+	}
+
+	/* the keystreams restart with every block, as the controllers do */
+	if (!unyaffs2_scramble_period) {
+		unyaffs2_scramble_period = unyaffs2_pages_per_block ?
+					   unyaffs2_pages_per_block :
+					   SCRAMBLER_PERIOD;
+	}
+
+	if (UNYAFFS2_ISSCRAMBLE &&
+	    scrambler_init(&unyaffs2_scrambler, unyaffs2_scramble_seed,
+			   unyaffs2_chunksize, unyaffs2_scramble_period) < 0) {
+		UNYAFFS2_ERROR("cannot set up the randomizer.\n");
+		nand_ecc_release(&unyaffs2_ecc);
+		return -1;
+	}
+
+	if (unyaffs2_verify_path) {
+		retval = unyaffs2_verify_image(imgfile, unyaffs2_verify_path);
+		scrambler_release(&unyaffs2_scrambler);
+		nand_ecc_release(&unyaffs2_ecc);
+		if (!retval)
+			UNYAFFS2_PRINTF("\nthe device matches the image.\n");
+		else
+			UNYAFFS2_ERROR("\nthe device does NOT match the "
+				       "image!!!\n");
+		unyaffs2_specfile_exit();
+		return retval;
+	}
+
 	retval = unyaffs2_extract_image(imgfile, dirpath);
+	scrambler_release(&unyaffs2_scrambler);
+	nand_ecc_release(&unyaffs2_ecc);
 	if (!retval) {
 		UNYAFFS2_PRINTF("\noperation complete,\n"
 				"files were extracted into '%s'.\n", dirpath);